@@ -0,0 +1,208 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <utility>
+#include <vector>
+#include <type_traits>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace bayolau {
+namespace memory {
+/**
+  * Bump allocator for the scratch memory of one thread, e.g. a pinned worker.
+  *
+  * Chunks are mapped when the owner first allocates from them, so that the kernel's first-touch policy
+  * places their pages on the owner's NUMA node. Bind(node) additionally asks the kernel to keep new
+  * chunks on that node, which holds even if another thread touches them first.
+  *
+  * Memory is never returned piecewise: Reset() recycles everything at once, keeping the chunks mapped.
+  * Objects created by New() are not destroyed, hence have to be trivially destructible.
+  * An arena is not thread-safe, only its owner may allocate from it.
+  */
+class Arena {
+public:
+  static constexpr size_t kDefaultChunk = size_t(1) << 20;
+
+  explicit Arena(size_t chunk_size = kDefaultChunk)
+    : chunks_(), current_(0), offset_(0), chunk_size_(RoundUp(chunk_size, PageSize())),
+      node_(std::numeric_limits<unsigned>::max()) { }
+
+  ~Arena() {
+    for(const auto& chunk: chunks_) munmap(chunk.base, chunk.size);
+  }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  /**
+    * @param align power of 2
+    * @return uninitialized storage, valid until Reset() or destruction
+    */
+  void* Allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+    for( ; current_ < chunks_.size() ; ++current_, offset_ = 0){
+      if( void* out = Bump(chunks_[current_], bytes, align) ) return out;
+    }
+    // chunks larger than chunk_size_ serve a single oversized allocation
+    const Chunk chunk = Map(std::max(chunk_size_, RoundUp(bytes + align, PageSize())));
+    if( !chunk.base ) throw std::bad_alloc();
+    chunks_.push_back(chunk);
+    current_ = chunks_.size() - 1;
+    offset_ = 0;
+    return Bump(chunks_.back(), bytes, align);
+  }
+
+  /**
+    * construct a T in the arena
+    */
+  template<class T, class... Args>
+  T* New(Args&&... args) {
+    static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+    return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  /**
+    * @return uninitialized storage for n objects of T
+    */
+  template<class T>
+  T* Allocate(size_t n) {
+    if( n > std::numeric_limits<size_t>::max() / sizeof(T) ) throw std::bad_alloc();
+    return static_cast<T*>(Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  /**
+    * recycle all allocations
+    */
+  void Reset() noexcept {
+    current_ = 0;
+    offset_ = 0;
+  }
+
+  /**
+    * bind chunks mapped from now on to a NUMA node, max() to rely on first touch only
+    */
+  void Bind(unsigned node) noexcept { node_ = node; }
+
+  unsigned node() const noexcept { return node_; }
+
+  /**
+    * @return bytes handed out since the last Reset(), including alignment padding
+    */
+  size_t used() const noexcept {
+    size_t out = offset_;
+    for(size_t cc = 0 ; cc < current_ and cc < chunks_.size() ; ++cc) out += chunks_[cc].size;
+    return out;
+  }
+
+  /**
+    * @return bytes mapped
+    */
+  size_t capacity() const noexcept {
+    size_t out = 0;
+    for(const auto& chunk: chunks_) out += chunk.size;
+    return out;
+  }
+
+private:
+  struct Chunk {
+    unsigned char* base;
+    size_t size;
+  };
+
+  std::vector<Chunk> chunks_;
+  size_t current_; // chunk being bumped
+  size_t offset_; // in the current chunk
+  const size_t chunk_size_;
+  unsigned node_;
+
+  void* Bump(const Chunk& chunk, size_t bytes, size_t align) {
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(chunk.base) + offset_;
+    const uintptr_t aligned = (begin + align - 1) & ~static_cast<uintptr_t>(align - 1);
+    const size_t end = aligned - reinterpret_cast<uintptr_t>(chunk.base) + bytes;
+    if( end > chunk.size or end < bytes ) return nullptr;
+    offset_ = end;
+    return reinterpret_cast<void*>(aligned);
+  }
+
+  /**
+    * @return a chunk of size bytes, NULL base if the mapping failed. Binding is best effort.
+    */
+  Chunk Map(size_t size) const {
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if( ptr == MAP_FAILED ) return Chunk{nullptr, 0};
+#ifdef SYS_mbind
+    if( node_ < 8 * sizeof(unsigned long) ){
+      const int kMpolBind = 2; // from linux/mempolicy.h, which may not be installed
+      const unsigned long mask = 1UL << node_;
+      syscall(SYS_mbind, ptr, size, kMpolBind, &mask, 8 * sizeof(unsigned long), 0);
+    }
+#endif
+    return Chunk{static_cast<unsigned char*>(ptr), size};
+  }
+
+  static size_t PageSize() {
+    static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page;
+  }
+
+  static size_t RoundUp(size_t n, size_t multiple) {
+    return (n + multiple - 1) / multiple * multiple;
+  }
+};
+
+/**
+  * standard allocator over an Arena, for containers living in a worker's scratch space.
+  * Deallocation is a no-op, memory comes back with Arena::Reset()
+  */
+template<typename T>
+struct ArenaAllocator{
+  typedef T value_type;
+
+  explicit ArenaAllocator(Arena& arena) noexcept : arena_(&arena) { }
+  template<typename U> ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena_(other.arena()) { }
+
+  T* allocate(size_t n) { return arena_->Allocate<T>(n); }
+  void deallocate(T*, size_t) noexcept { }
+
+  Arena* arena() const noexcept { return arena_; }
+
+  template<typename U> bool operator==(const ArenaAllocator<U>& other) const noexcept { return arena_ == other.arena(); }
+  template<typename U> bool operator!=(const ArenaAllocator<U>& other) const noexcept { return arena_ != other.arena(); }
+
+private:
+  Arena* arena_;
+};
+
+}
+}
+
+#endif
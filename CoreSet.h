@@ -0,0 +1,163 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CORE_SET_H
+#define CORE_SET_H
+
+#include <vector>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+
+namespace bayolau {
+namespace affinity {
+
+namespace detail {
+/**
+  * process-wide record of the logical cpus held by CoreSets
+  */
+struct CoreRegistry{
+  static CoreRegistry& Instance(){
+    static CoreRegistry instance; // thread safe in c++11
+    return instance;
+  }
+  /**
+    * reserve all of cpus, or none of them
+    * @return true if error occurs, i.e. some cpu is already reserved
+    */
+  bool ReserveAll(const std::vector<unsigned>& cpus){
+    std::lock_guard<std::mutex> lg(lk_);
+    for(unsigned cpu: cpus){
+      if( reserved(cpu) ) return true;
+    }
+    for(unsigned cpu: cpus) Mark(cpu, true);
+    return false;
+  }
+  /**
+    * reserve the first n groups (e.g. cores) none of whose cpus is reserved, all free groups if n is 0
+    * @return the reserved cpus, empty if there are not enough free groups
+    */
+  std::vector<unsigned> ReserveFree(const std::vector<std::vector<unsigned> >& groups, size_t n){
+    std::lock_guard<std::mutex> lg(lk_);
+    std::vector<unsigned> out;
+    size_t num_groups = 0;
+    for(const auto& group: groups){
+      if( n > 0 and num_groups == n ) break;
+      if( group.empty() or std::any_of(group.begin(), group.end(), [this](unsigned cpu){ return reserved(cpu); }) ) continue;
+      out.insert(out.end(), group.begin(), group.end());
+      ++num_groups;
+    }
+    if( num_groups == 0 or num_groups < n ) return std::vector<unsigned>();
+    for(unsigned cpu: out) Mark(cpu, true);
+    return out;
+  }
+  /**
+    * @return the cpus which are not reserved
+    */
+  std::vector<unsigned> Unreserved(const std::vector<unsigned>& cpus){
+    std::lock_guard<std::mutex> lg(lk_);
+    std::vector<unsigned> out;
+    for(unsigned cpu: cpus){
+      if( !reserved(cpu) ) out.push_back(cpu);
+    }
+    return out;
+  }
+  void Release(const std::vector<unsigned>& cpus){
+    std::lock_guard<std::mutex> lg(lk_);
+    for(unsigned cpu: cpus) Mark(cpu, false);
+  }
+private:
+  std::mutex lk_;
+  std::vector<bool> reserved_; // indexed by logical cpu, guarded by lk_
+
+  bool reserved(unsigned cpu) const { return cpu < reserved_.size() and reserved_[cpu]; }
+  void Mark(unsigned cpu, bool value){
+    if( cpu >= reserved_.size() ) reserved_.resize(cpu + 1, false);
+    reserved_[cpu] = value;
+  }
+};
+}
+
+/**
+  * Logical cpus reserved for exclusive use, e.g. by one ThreadPool, until destruction.
+  * Obtained from CpuTopology::ReserveCores, ReserveNode, ReserveCache or ReserveCpus;
+  * no two CoreSets in a process share a cpu.
+  */
+class CoreSet{
+public:
+  CoreSet() noexcept : cpus_() { }
+  CoreSet(CoreSet&& other) noexcept : cpus_(std::move(other.cpus_)) { other.cpus_.clear(); }
+  CoreSet& operator=(CoreSet&& other) noexcept {
+    if( this != &other ){
+      Release();
+      cpus_.swap(other.cpus_);
+    }
+    return *this;
+  }
+  CoreSet(const CoreSet&) = delete;
+  CoreSet& operator=(const CoreSet&) = delete;
+  ~CoreSet() { Release(); }
+
+  /**
+    * @return reserved logical cpus, in increasing order
+    */
+  const std::vector<unsigned>& cpus() const noexcept { return cpus_; }
+  size_t size() const noexcept { return cpus_.size(); }
+  /**
+    * @return true if nothing is reserved, e.g. the reservation failed
+    */
+  bool empty() const noexcept { return cpus_.empty(); }
+  /**
+    * take over the cpus of another reservation, e.g. to grow a pool
+    */
+  void Merge(CoreSet&& other) {
+    cpus_.insert(cpus_.end(), other.cpus_.begin(), other.cpus_.end());
+    other.cpus_.clear();
+    std::sort(cpus_.begin(), cpus_.end());
+  }
+  /**
+    * give the cpus back before destruction
+    */
+  void Release() noexcept {
+    if( cpus_.empty() ) return;
+    detail::CoreRegistry::Instance().Release(cpus_);
+    cpus_.clear();
+  }
+
+private:
+  friend struct CpuTopology;
+  std::vector<unsigned> cpus_;
+
+  /**
+    * takes over cpus already marked in the registry
+    */
+  explicit CoreSet(std::vector<unsigned> cpus) : cpus_(std::move(cpus)) {
+    std::sort(cpus_.begin(), cpus_.end());
+  }
+};
+
+}
+}
+
+#endif
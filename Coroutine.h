@@ -0,0 +1,345 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+/**
+  * C++20 coroutines on top of BasicThreadPool. Everything below is compiled out on older standards,
+  * so that including this header does not raise the requirement of the rest of the library.
+  */
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <atomic>
+#include "ThreadPool.h"
+
+namespace bayolau {
+namespace affinity {
+namespace coro {
+
+template<class T = void> class Task;
+template<class T> struct AllOf;
+template<class T> Task<std::vector<T>> WhenAll(std::vector<Task<T>> tasks);
+Task<void> WhenAll(std::vector<Task<void>> tasks);
+
+namespace detail {
+/**
+  * resumes a suspended coroutine, as a work package of the pool
+  */
+struct Resumption {
+  std::coroutine_handle<> handle;
+  void operator()() const { handle.resume(); }
+};
+
+struct PromiseBase {
+  std::coroutine_handle<> continuation = nullptr; // resumed on completion
+  std::exception_ptr error = nullptr;
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template<class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      std::coroutine_handle<> continuation = handle.promise().continuation;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+    void await_resume() noexcept { }
+  };
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template<class T>
+struct Promise : PromiseBase {
+  std::optional<T> value;
+
+  Task<T> get_return_object() noexcept;
+
+  template<class U>
+  void return_value(U&& out) { value.emplace(std::forward<U>(out)); }
+
+  T result() {
+    if( error ) std::rethrow_exception(error);
+    return std::move(*value);
+  }
+};
+
+template<>
+struct Promise<void> : PromiseBase {
+  Task<void> get_return_object() noexcept;
+  void return_void() noexcept { }
+  void result() {
+    if( error ) std::rethrow_exception(error);
+  }
+};
+
+/**
+  * a coroutine which starts right away and frees itself once done, for the plumbing below
+  */
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept { }
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+}
+
+/**
+  * A lazily started coroutine returning T. It runs when awaited, on the thread awaiting it, until it suspends;
+  * it then resumes wherever the awaitables it waits for resume it, e.g. on a worker with co_await Resume(pool).
+  * The awaiting coroutine is resumed by symmetric transfer on completion, without going through any queue.
+  */
+template<class T>
+class Task {
+public:
+  using promise_type = detail::Promise<T>;
+
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) { }
+  Task& operator=(Task&& other) noexcept {
+    if( this != &other ){
+      if( handle_ ) handle_.destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  ~Task() { if( handle_ ) handle_.destroy(); }
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  /**
+    * @return true if the coroutine has completed
+    */
+  bool done() const noexcept { return !handle_ or handle_.done(); }
+
+  auto operator co_await() && noexcept { return Awaiter{handle_}; }
+  auto operator co_await() & noexcept { return Awaiter{handle_}; }
+
+private:
+  template<class U> friend struct detail::Promise;
+  template<class U> friend Task<std::vector<U>> WhenAll(std::vector<Task<U>> tasks);
+  friend Task<void> WhenAll(std::vector<Task<void>> tasks);
+  template<class U> friend struct AllOf;
+
+  std::coroutine_handle<promise_type> handle_;
+
+  explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) { }
+
+  struct Awaiter {
+    std::coroutine_handle<promise_type> handle;
+    bool await_ready() const noexcept { return !handle or handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+      handle.promise().continuation = awaiting;
+      return handle;
+    }
+    T await_resume() { return handle.promise().result(); }
+  };
+};
+
+namespace detail {
+template<class T>
+Task<T> Promise<T>::get_return_object() noexcept {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+inline Task<void> Promise<void>::get_return_object() noexcept {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+}
+
+/**
+  * co_await Resume(pool) continues the coroutine on a worker of pool, as an ordinary work package
+  */
+template<class Pool>
+auto Resume(Pool& pool, Priority priority = Priority::Normal) noexcept {
+  struct Awaiter {
+    Pool& pool;
+    Priority priority;
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      return pool.TrySubmit(priority, detail::Resumption{handle}); // continue inline if the pool is at capacity
+    }
+    void await_resume() const noexcept { }
+  };
+  return Awaiter{pool, priority};
+}
+
+/**
+  * co_await ResumeOn(pool, Target::Cpu(k)) continues the coroutine on the worker pinned to logical cpu k,
+  * or on any worker of a cache domain or NUMA node, see Target
+  */
+template<class Pool>
+auto ResumeOn(Pool& pool, const Target& target) noexcept {
+  struct Awaiter {
+    Pool& pool;
+    Target target;
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      return pool.TrySubmit(target, detail::Resumption{handle}); // continue inline if the pool is at capacity
+    }
+    void await_resume() const noexcept { }
+  };
+  return Awaiter{pool, target};
+}
+
+/**
+  * awaits a set of tasks, started concurrently on the awaiting thread; the last one to finish resumes the awaiter
+  */
+template<class T>
+struct AllOf {
+  std::vector<Task<T>>& tasks;
+  std::atomic<size_t> count{0};
+  std::coroutine_handle<> awaiting = nullptr;
+
+  bool await_ready() const noexcept { return tasks.empty(); }
+  bool await_suspend(std::coroutine_handle<> handle) {
+    awaiting = handle;
+    count = tasks.size() + 1; // held by await_suspend until all tasks are started
+    for(auto& task : tasks) Start(task);
+    return count.fetch_sub(1) != 1;
+  }
+  void await_resume() const noexcept { }
+
+private:
+  struct Ready {
+    std::coroutine_handle<detail::Promise<T>> handle;
+    bool await_ready() const noexcept { return handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiting) noexcept {
+      handle.promise().continuation = waiting;
+      return handle;
+    }
+    void await_resume() const noexcept { } // the result is collected later
+  };
+
+  detail::Detached Start(Task<T>& task) {
+    co_await Ready{task.handle_};
+    if( count.fetch_sub(1) == 1 ) awaiting.resume();
+  }
+};
+
+/**
+  * co_await WhenAll(std::move(tasks)) runs the tasks concurrently
+  * @return their results in order; the first exception is rethrown once all are done
+  */
+template<class T>
+Task<std::vector<T>> WhenAll(std::vector<Task<T>> tasks) {
+  co_await AllOf<T>{tasks};
+  std::vector<T> out;
+  out.reserve(tasks.size());
+  for(auto& task : tasks) out.push_back(task.handle_.promise().result());
+  co_return out;
+}
+
+inline Task<void> WhenAll(std::vector<Task<void>> tasks) {
+  co_await AllOf<void>{tasks};
+  for(auto& task : tasks) task.handle_.promise().result();
+}
+
+namespace detail {
+template<class T>
+Detached Complete(Task<T> task, TaskGroup& group, std::optional<T>& out) {
+  try {
+    out.emplace(co_await std::move(task));
+  }
+  catch(...) {
+    group.done(std::current_exception());
+    co_return;
+  }
+  group.done();
+}
+
+inline Detached Complete(Task<void> task, TaskGroup& group) {
+  try {
+    co_await std::move(task);
+  }
+  catch(...) {
+    group.done(std::current_exception());
+    co_return;
+  }
+  group.done();
+}
+
+template<class Pool>
+Detached Launch(Pool& pool, Task<void> task) {
+  co_await Resume(pool);
+  std::exception_ptr error;
+  try {
+    co_await std::move(task);
+  }
+  catch(...) {
+    error = std::current_exception();
+  }
+  if( error ) pool.ReportException(error); // directly, as a queued package could be refused at capacity
+}
+}
+
+/**
+  * run a task from a thread outside the pool and block until it is done
+  * @return its result
+  */
+template<class T>
+T SyncWait(Task<T> task) {
+  TaskGroup group;
+  group.add();
+  std::optional<T> out;
+  detail::Complete(std::move(task), group, out);
+  group.get();
+  return std::move(*out);
+}
+
+inline void SyncWait(Task<void> task) {
+  TaskGroup group;
+  group.add();
+  detail::Complete(std::move(task), group);
+  group.get();
+}
+
+/**
+  * start a task on a worker of pool without waiting for it, e.g. one per incoming request.
+  * An exception escaping the task is passed to the pool's exception handler
+  */
+template<class Pool>
+void Spawn(Pool& pool, Task<void> task) {
+  detail::Launch(pool, std::move(task));
+}
+
+}
+}
+}
+
+#endif
+#endif
+
+#endif
@@ -25,68 +25,702 @@ SOFTWARE.
 #ifndef CPU_TOPOLOGY_H
 #define CPU_TOPOLOGY_H
 
+#include <vector>
+#include <thread>
+#include <future>
+#include <iostream>
+#include <pthread.h>
+#include <string>
+#include <limits>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <sched.h>
+#include <memory>
+#include <algorithm>
+#include <map>
 #include "ThreadTopology.h"
+#include "NumaTopology.h"
+#include "Placement.h"
+#include "CoreSet.h"
 
 namespace bayolau {
 namespace affinity {
 
 struct CpuTopology{
   /**
-    * only need to do this once, hardware is not going to change
+    * only need to do this once, hardware is not going to change.
+    * If the environment variable AFFINITY_TOPOLOGY_FILE names a file saved by Save, it is loaded
+    * instead of discovering the machine; if the file does not exist yet, it is written after discovery.
+    * The result is restricted to the cpus this process may run on and to its cgroup cpu quota.
     */
   static const CpuTopology& Instance(){
-    static CpuTopology instance; // thread safe in c++11
+    static CpuTopology instance(Discover().Restrict(AllowedCpus(), CpuQuota())); // thread safe in c++11
     return instance;
   }
   /**
-    * @return number of cores, discarding hyperthreaded cores
+    * @return logical cpus in the affinity mask of the calling process (sched_getaffinity), e.g. the cpuset of a container,
+    *         or an empty list if the mask cannot be read
     */
-  size_t num_cores() const noexcept { return core_masks_.size(); }
+  static std::vector<unsigned> AllowedCpus(){
+    std::vector<unsigned> out;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if( sched_getaffinity(0, sizeof(cpu_set_t), &cpu_set) != 0 ) return out;
+    for(unsigned cpu = 0 ; cpu < CPU_SETSIZE ; ++cpu){
+      if( CPU_ISSET(cpu, &cpu_set) ) out.push_back(cpu);
+    }
+    return out;
+  }
   /**
-    * iterate through the provided thread list and set affinity in a round-robin fashion
+    * reads the cgroup cpu bandwidth limit of the process, cgroup v2 cpu.max first, then v1 cpu.cfs_quota_us/cpu.cfs_period_us.
+    * The limit is looked up in the cgroup named in proc_cgroup and in each of its ancestors, the tightest one applying,
+    * so that it is found both on hosts and in containers whose cgroup is mounted as the root of the hierarchy.
+    * @param cgroup_root mount point of the cgroup hierarchy as seen by the process, can point to a fake tree for testing
+    * @param proc_cgroup cgroup membership of the process, in the format of /proc/self/cgroup
+    * @return number of cpus worth of quota rounded up, or 0 if there is no limit
     */
-  void SetAffinity(std::vector<std::thread>& threads) const {
-    if( num_cores() == 0) return;
-    cpu_set_t cpu_set;
-    for(size_t tt = 0 ; tt < threads.size() ; ++tt){
-      CPU_ZERO(&cpu_set);
-      CPU_SET(core_masks_[tt%core_masks_.size()],&cpu_set);
-      pthread_setaffinity_np(threads[tt].native_handle(),sizeof(cpu_set_t),&cpu_set);
+  static unsigned CpuQuota(const std::string& cgroup_root = "/sys/fs/cgroup", const std::string& proc_cgroup = "/proc/self/cgroup"){
+    std::string v2_path, v1_path;
+    ReadCgroupPaths(proc_cgroup, v2_path, v1_path);
+    unsigned out = 0;
+    bool found = false;
+    for(const std::string& dir: CgroupAncestors(v2_path)){
+      std::string text;
+      if( util::ReadFile(cgroup_root + dir + "/cpu.max", text) ) continue;
+      found = true;
+      std::istringstream iss(text);
+      std::string quota;
+      long long period = 0;
+      if( !(iss >> quota >> period) or quota == "max" ) continue;
+      out = TighterQuota(out, std::atoll(quota.c_str()), period);
+    }
+    if( found ) return out;
+    const char* mounts[] = { "/cpu", "/cpu,cpuacct" };
+    for(const char* mount: mounts){
+      for(const std::string& dir: CgroupAncestors(v1_path)){
+        std::string quota_text, period_text;
+        if( !util::ReadFile(cgroup_root + mount + dir + "/cpu.cfs_quota_us", quota_text)
+            and !util::ReadFile(cgroup_root + mount + dir + "/cpu.cfs_period_us", period_text) ){
+          found = true;
+          out = TighterQuota(out, std::atoll(quota_text.c_str()), std::atoll(period_text.c_str()));
+        }
+      }
+      if( found ) break;
     }
+    return out;
   }
-  
-private:
-  std::vector<affinity::ThreadTopology> mask_topology_;
-  std::vector<unsigned> core_masks_;
-
-  CpuTopology():mask_topology_(std::thread::hardware_concurrency()){
-    const unsigned num_threads = mask_topology_.size();
+  /**
+    * limits the cores used for pinning to allowed logical cpus; a core is kept if any of its hyperthreads is allowed.
+    * @param allowed logical cpus the process may use, no restriction if empty
+    * @param quota number of cpus worth of cgroup quota, 0 for no limit
+    * @return *this
+    */
+  CpuTopology& Restrict(std::vector<unsigned> allowed, unsigned quota){
+    std::sort(allowed.begin(), allowed.end());
+    allowed_.clear();
+    for(unsigned cpu = 0 ; cpu < num_cpus() ; ++cpu){
+      if( allowed.empty() or std::binary_search(allowed.begin(), allowed.end(), cpu) ) allowed_.push_back(cpu);
+    }
+    quota_ = quota;
+    Index();
+    return *this;
+  }
+  /**
+    * reads the topology of every online cpu below sysfs_root without spawning or migrating threads
+    * @param sysfs_root mount point of sysfs, can point to a fake tree for testing
+    * @return topology with no core if the tree does not describe any cpu
+    */
+  static CpuTopology ReadSysfs(const std::string& sysfs_root = "/sys"){
+    const std::string base = sysfs_root + "/devices/system/cpu/";
+    std::string text;
+    std::vector<unsigned> online;
+    if( util::ReadFile(base + "online", text) or util::ParseCpuList(text, online) ) online.clear();
+    std::vector<ThreadTopology> cpus(online.empty() ? 0 : online.back() + 1);
+    const std::vector<ThreadTopology::CoreType> core_types = ReadCoreTypes(sysfs_root, online, cpus.size());
+    for(unsigned cpu: online){
+      std::ostringstream oss;
+      oss << base << "cpu" << cpu << "/";
+      const std::string dir = oss.str();
+      std::vector<unsigned> siblings;
+      unsigned core, package;
+      if( util::ReadFile(dir + "topology/thread_siblings_list", text) or util::ParseCpuList(text, siblings)
+          or ReadUnsigned(dir + "topology/core_id", core) or ReadUnsigned(dir + "topology/physical_package_id", package) ){
+        continue;
+      }
+      const unsigned smt = std::find(siblings.begin(), siblings.end(), cpu) - siblings.begin();
+      std::vector<ThreadTopology::Cache> caches;
+      for(unsigned index = 0 ; ; ++index){
+        std::ostringstream cache_dir;
+        cache_dir << dir << "cache/index" << index << "/";
+        unsigned level;
+        std::vector<unsigned> sharing;
+        if( ReadUnsigned(cache_dir.str() + "level", level) or util::ReadFile(cache_dir.str() + "shared_cpu_list", text)
+            or util::ParseCpuList(text, sharing) or sharing.empty() ){
+          break;
+        }
+        std::string type;
+        util::ReadFile(cache_dir.str() + "type", type);
+        // the lowest sharing cpu identifies the cache instance among the cpus
+        caches.push_back(ThreadTopology::Cache{ level,
+            type.compare(0, 4, "Data") == 0 ? ThreadTopology::CacheType::Data
+            : type.compare(0, 11, "Instruction") == 0 ? ThreadTopology::CacheType::Instruction
+            : ThreadTopology::CacheType::Unified,
+            sharing.front() });
+      }
+      std::vector<unsigned> level_ids = {smt, core, package};
+      cpus[cpu] = ThreadTopology(std::numeric_limits<unsigned>::max(), std::move(level_ids), std::move(caches),
+                                 std::vector<ThreadTopology::LevelType>(), core_types[cpu]);
+    }
+    return CpuTopology(std::move(cpus), NumaTopology::Read(sysfs_root));
+  }
+  /**
+    * acquires the topology by running CPUID on every logical cpu, which spawns and pins one thread per cpu
+    */
+  static CpuTopology Probe(){
+    // only the cpus of our affinity mask can be probed, the others stay invalid
+    const std::vector<unsigned> allowed = AllowedCpus();
+    std::vector<ThreadTopology> cpus(allowed.empty() ? std::thread::hardware_concurrency() : allowed.back() + 1);
+    const unsigned num_threads = allowed.empty() ? cpus.size() : allowed.size();
+    std::unique_ptr<bool[]> failed(new bool[num_threads]());
     std::promise<void> start_signal;
     std::shared_future<void> sf(start_signal.get_future());
     std::vector<std::thread> threads;
     threads.reserve(num_threads);
     for(unsigned tt = 0 ; tt < num_threads; ++tt){
-      threads.emplace_back(LogTopology,sf,std::ref(mask_topology_[tt]));
-      cpu_set_t cpu_set;
-      CPU_ZERO(&cpu_set);
-      CPU_SET(tt,&cpu_set);
-      pthread_setaffinity_np(threads[tt].native_handle(),sizeof(cpu_set_t),&cpu_set);
+      const unsigned cpu = allowed.empty() ? tt : allowed[tt];
+      threads.emplace_back(LogTopology,sf,std::cref(failed[tt]),std::ref(cpus[cpu]));
+      failed[tt] = Pin(threads[tt], cpu);
     }
     start_signal.set_value();
     for(auto& entry: threads){
       entry.join();
     }
-    core_masks_.clear();
-    for(unsigned tt = 0 ; tt < num_threads; ++tt){
-      const auto& tp = mask_topology_[tt];
-      if( tp.valid() and tp.level_ids().size() > 0 and tp.level_ids().front() == 0 ){
-        core_masks_.push_back(tt);
+    return CpuTopology(std::move(cpus), NumaTopology::Read());
+  }
+  /**
+    * writes the topology in a text format read by Load
+    */
+  void Save(std::ostream& os) const {
+    os << kFileTag << " " << kFileVersion << "\n";
+    os << "cpus " << num_cpus() << "\n";
+    for(const auto& tp: mask_topology_){
+      if( !tp.valid() ) { os << "invalid\n"; continue; }
+      os << "valid " << tp.u2xapic() << " " << static_cast<unsigned>(tp.core_type()) << " " << tp.level_ids().size();
+      for(unsigned id: tp.level_ids()) os << " " << id;
+      for(auto type: tp.level_types()) os << " " << static_cast<unsigned>(type);
+      os << " " << tp.caches().size();
+      for(const auto& cache: tp.caches()){
+        os << " " << cache.level << " " << static_cast<unsigned>(cache.type) << " " << cache.id;
+      }
+      os << "\n";
+    }
+    numa_.Save(os);
+  }
+  /**
+    * reads a topology written by Save, throws std::runtime_error on malformed input
+    */
+  static CpuTopology Load(std::istream& is){
+    std::string tag;
+    unsigned version;
+    size_t num_cpus;
+    if( !(is >> tag >> version) or tag != kFileTag or version != kFileVersion )
+      throw std::runtime_error("unknown topology file format");
+    if( !(is >> tag >> num_cpus) or tag != "cpus" ) throw std::runtime_error("malformed topology file");
+    std::vector<ThreadTopology> cpus(num_cpus);
+    for(auto& tp: cpus){
+      if( !(is >> tag) ) throw std::runtime_error("malformed topology file");
+      if( tag == "invalid" ) continue;
+      unsigned u2xapic, core_type;
+      size_t num_levels, num_caches;
+      if( tag != "valid" or !(is >> u2xapic >> core_type >> num_levels) ) throw std::runtime_error("malformed topology file");
+      std::vector<unsigned> level_ids(num_levels);
+      for(auto& id: level_ids) is >> id;
+      std::vector<ThreadTopology::LevelType> level_types(num_levels);
+      for(auto& type: level_types){
+        unsigned value = 0;
+        is >> value;
+        type = static_cast<ThreadTopology::LevelType>(value);
+      }
+      is >> num_caches;
+      if( !is ) throw std::runtime_error("malformed topology file");
+      std::vector<ThreadTopology::Cache> caches(num_caches);
+      for(auto& cache: caches){
+        unsigned type;
+        is >> cache.level >> type >> cache.id;
+        cache.type = static_cast<ThreadTopology::CacheType>(type);
+      }
+      if( !is ) throw std::runtime_error("malformed topology file");
+      tp = ThreadTopology(u2xapic, std::move(level_ids), std::move(caches), std::move(level_types),
+                          static_cast<ThreadTopology::CoreType>(core_type));
+    }
+    return CpuTopology(std::move(cpus), NumaTopology::Load(is));
+  }
+  /**
+    * builds the topology from known data instead of probing the hardware, e.g. for testing
+    * @param cpus snapshot of each logical cpu, indexed by cpu number
+    * @param numa node layout, typically NumaTopology::Read on a (fake) sysfs tree;
+    *             all cpus are put on node 0 if empty
+    */
+  CpuTopology(std::vector<ThreadTopology> cpus, NumaTopology numa)
+    : mask_topology_(std::move(cpus)), numa_(std::move(numa)), allowed_(), quota_(0) {
+    Restrict(std::vector<unsigned>(), 0);
+  }
+  /**
+    * @return number of cores, discarding hyperthreaded cores
+    */
+  size_t num_cores() const noexcept { return core_masks_.size(); }
+  /**
+    * @return the logical cpu which SetAffinity assigns to the tt-th thread
+    */
+  unsigned cpu_of(size_t tt) const noexcept { return core_masks_[tt%core_masks_.size()]; }
+  /**
+    * @return topology of a logical cpu
+    */
+  const ThreadTopology& topology(unsigned cpu) const noexcept { return mask_topology_[cpu]; }
+  /**
+    * @return number of logical cpus, including hyperthreaded ones
+    */
+  size_t num_cpus() const noexcept { return mask_topology_.size(); }
+  /**
+    * @return logical cpus sharing the data/unified cache of a level (1 for L1 etc) with cpu, including cpu itself.
+    *         Only cpu is returned if the cache of that level is unknown.
+    */
+  std::vector<unsigned> cpus_sharing_cache(unsigned cpu, unsigned level) const {
+    const unsigned none = std::numeric_limits<unsigned>::max();
+    const unsigned id = cpu < num_cpus() ? topology(cpu).cache_id(level) : none;
+    if( id == none ) return std::vector<unsigned>(1, cpu);
+    std::vector<unsigned> out;
+    for(unsigned other = 0 ; other < num_cpus() ; ++other){
+      if( topology(other).cache_id(level) == id ) out.push_back(other);
+    }
+    return out;
+  }
+  /**
+    * @return core type of a logical cpu, Unknown on non-hybrid parts
+    */
+  ThreadTopology::CoreType core_type(unsigned cpu) const noexcept {
+    return cpu < num_cpus() ? topology(cpu).core_type() : ThreadTopology::CoreType::Unknown;
+  }
+  /**
+    * @return allowed logical cpus of a core type
+    */
+  std::vector<unsigned> cpus_of_type(ThreadTopology::CoreType type) const {
+    std::vector<unsigned> out;
+    for(unsigned cpu: allowed_){
+      if( core_type(cpu) == type ) out.push_back(cpu);
+    }
+    return out;
+  }
+  /**
+    * @return 0 for the same logical cpu, 1 for SMT siblings, 2 for cores sharing the last level cache (e.g. an AMD CCX),
+    *         3 for the same package, 4 for the same NUMA node and 5 otherwise; unsigned max if either cpu is unknown
+    */
+  unsigned distance(unsigned cpu_a, unsigned cpu_b) const noexcept {
+    if( cpu_a >= num_cpus() or cpu_b >= num_cpus() ) return std::numeric_limits<unsigned>::max();
+    const ThreadTopology& a = topology(cpu_a);
+    const ThreadTopology& b = topology(cpu_b);
+    if( !a.valid() or !b.valid() ) return std::numeric_limits<unsigned>::max();
+    if( cpu_a == cpu_b ) return 0;
+    const unsigned levels = a.distance(b);
+    if( levels <= 1 ) return 1;
+    unsigned last_level = 0;
+    for(const auto& cache: a.caches()) last_level = std::max(last_level, cache.level);
+    if( last_level > 1 and a.cache_id(last_level) != std::numeric_limits<unsigned>::max()
+        and a.cache_id(last_level) == b.cache_id(last_level) ) return 2;
+    if( levels < a.level_ids().size() ) return 3;
+    if( node_of(cpu_a) == node_of(cpu_b) ) return 4;
+    return 5;
+  }
+  /**
+    * reserve n whole cores (all their allowed hyperthreads), taking free cores in compact order
+    * @param n number of cores, 0 for all free cores
+    * @return the reserved cpus, empty if there are not enough free cores
+    */
+  CoreSet ReserveCores(size_t n) const {
+    return CoreSet(detail::CoreRegistry::Instance().ReserveFree(Cores(allowed_), n));
+  }
+  /**
+    * reserve the whole cores under the first num_threads cpus of a placement over the free cpus,
+    * e.g. for a pool following that placement
+    * @param num_threads number of threads to place, 0 for all
+    * @return the reserved cpus, empty if the placement is Unpinned or finds no free cpu
+    */
+  CoreSet Reserve(const Placement& placement, size_t num_threads = 0) const {
+    // another reservation may slip in between looking and reserving
+    for(unsigned attempt = 0 ; attempt < 3 ; ++attempt){
+      const std::vector<unsigned> free_cpus = detail::CoreRegistry::Instance().Unreserved(allowed_);
+      std::vector<unsigned> cpus = Place(placement, free_cpus);
+      if( cpus.empty() ) break;
+      if( num_threads > 0 and num_threads < cpus.size() ) cpus.resize(num_threads);
+      std::vector<unsigned> whole;
+      for(unsigned cpu: cpus){
+        for(unsigned sibling: siblings(cpu)){
+          if( std::binary_search(free_cpus.begin(), free_cpus.end(), sibling) ) whole.push_back(sibling);
+        }
+      }
+      std::sort(whole.begin(), whole.end());
+      whole.erase(std::unique(whole.begin(), whole.end()), whole.end());
+      CoreSet out = ReserveCpus(whole);
+      if( !out.empty() ) return out;
+    }
+    return CoreSet();
+  }
+  /**
+    * @return allowed hyperthreads of the core of cpu, including cpu itself
+    */
+  std::vector<unsigned> siblings(unsigned cpu) const {
+    std::vector<unsigned> out;
+    for(unsigned other: allowed_){
+      if( other == cpu or distance(cpu, other) == 1 ) out.push_back(other);
+    }
+    return out;
+  }
+  /**
+    * reserve all allowed cpus of a NUMA node
+    * @return the reserved cpus, empty if the node has no allowed cpu or some of them are reserved already
+    */
+  CoreSet ReserveNode(unsigned node) const {
+    std::vector<unsigned> cpus;
+    for(unsigned cpu: allowed_){
+      if( node_of(cpu) == node ) cpus.push_back(cpu);
+    }
+    return ReserveCpus(cpus);
+  }
+  /**
+    * reserve all allowed cpus sharing the cache of a level with cpu, e.g. the L3 domain (an AMD CCX) of cpu
+    * @return the reserved cpus, empty if some of them are reserved already
+    */
+  CoreSet ReserveCache(unsigned cpu, unsigned level = 3) const {
+    std::vector<unsigned> cpus;
+    for(unsigned other: cpus_sharing_cache(cpu, level)){
+      if( std::binary_search(allowed_.begin(), allowed_.end(), other) ) cpus.push_back(other);
+    }
+    return ReserveCpus(cpus);
+  }
+  /**
+    * reserve the given logical cpus
+    * @return the reserved cpus, empty if cpus is empty or some of them are reserved already
+    */
+  CoreSet ReserveCpus(const std::vector<unsigned>& cpus) const {
+    if( cpus.empty() or detail::CoreRegistry::Instance().ReserveAll(cpus) ) return CoreSet();
+    return CoreSet(cpus);
+  }
+  /**
+    * @return NUMA layout of the machine, i.e. nodes, their cpus and distances
+    */
+  const NumaTopology& numa() const noexcept { return numa_; }
+  /**
+    * @return NUMA node of a logical cpu
+    */
+  unsigned node_of(unsigned cpu) const noexcept { return numa_.node_of(cpu); }
+  /**
+    * @return NUMA distance between the nodes of two logical cpus, 10 being local
+    */
+  unsigned numa_distance(unsigned cpu_a, unsigned cpu_b) const noexcept {
+    return numa_.distance(node_of(cpu_a), node_of(cpu_b));
+  }
+  /**
+    * @return logical cpus the process may use
+    */
+  const std::vector<unsigned>& allowed_cpus() const noexcept { return allowed_; }
+  /**
+    * @return cgroup cpu quota in number of cpus, 0 if unlimited
+    */
+  unsigned cpu_quota() const noexcept { return quota_; }
+  /**
+    * @return number of threads which can run in parallel, i.e. allowed logical cpus capped by the cpu quota, at least 1
+    */
+  size_t concurrency() const noexcept {
+    size_t out = allowed_.empty() ? std::max(1u, std::thread::hardware_concurrency()) : allowed_.size();
+    if( quota_ > 0 ) out = std::min<size_t>(out, quota_);
+    return out;
+  }
+  /**
+    * iterate through the provided thread list and set affinity in a round-robin fashion
+    * @return true if error occurs, i.e. there is no core to pin to or a thread could not be pinned
+    */
+  bool SetAffinity(std::vector<std::thread>& threads) const {
+    if( num_cores() == 0) return true;
+    bool failed = false;
+    for(size_t tt = 0 ; tt < threads.size() ; ++tt){
+      failed = Pin(threads[tt], cpu_of(tt)) or failed;
+    }
+    return failed;
+  }
+  /**
+    * pin thread tt to cpus[tt % cpus.size()]
+    * @return true if error occurs, i.e. cpus is empty or a thread could not be pinned
+    */
+  bool SetAffinity(std::vector<std::thread>& threads, const std::vector<unsigned>& cpus) const {
+    if( cpus.empty() ) return true;
+    bool failed = false;
+    for(size_t tt = 0 ; tt < threads.size() ; ++tt){
+      failed = Pin(threads[tt], cpus[tt % cpus.size()]) or failed;
+    }
+    return failed;
+  }
+  /**
+    * let a thread float over all allowed cpus again
+    * @return true if error occurs
+    */
+  bool Unpin(std::thread& thread) const {
+    return Unpin(thread, allowed_);
+  }
+  /**
+    * let a thread float over a set of cpus, e.g. those of a CoreSet
+    * @return true if error occurs
+    */
+  bool Unpin(std::thread& thread, const std::vector<unsigned>& within) const {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for(unsigned cpu: within){
+      if( cpu < CPU_SETSIZE ) CPU_SET(cpu,&cpu_set);
+    }
+    if( CPU_COUNT(&cpu_set) == 0 ) return true;
+    return pthread_setaffinity_np(thread.native_handle(),sizeof(cpu_set_t),&cpu_set) != 0;
+  }
+  /**
+    * pin threads according to a placement, leaving them alone if it is Unpinned
+    * @return true if error occurs
+    */
+  bool SetAffinity(std::vector<std::thread>& threads, const Placement& placement) const {
+    return placement.pinned() and SetAffinity(threads, Place(placement));
+  }
+  /**
+    * @return the logical cpus of a placement, one per thread in thread order, restricted to allowed cpus;
+    *         empty for Placement::Unpinned
+    */
+  std::vector<unsigned> Place(const Placement& placement) const {
+    return Place(placement, allowed_);
+  }
+  /**
+    * @return the logical cpus of a placement, one per thread in thread order, restricted to within,
+    *         e.g. the cpus of a CoreSet; empty for Placement::Unpinned
+    */
+  std::vector<unsigned> Place(const Placement& placement, const std::vector<unsigned>& within) const {
+    std::vector<unsigned> out;
+    const auto cores = Cores(within);
+    switch( placement.policy() ){
+      case Placement::Policy::Unpinned:
+        break;
+      case Placement::Policy::Explicit:
+        for(unsigned cpu: placement.cpus()){
+          if( std::find(within.begin(), within.end(), cpu) != within.end() ) out.push_back(cpu);
+        }
+        break;
+      case Placement::Policy::Compact:
+      case Placement::Policy::ThreadsPerCore:
+        for(const auto& core: cores){
+          const size_t num_siblings = std::min<size_t>(core.size(), std::max(1u, placement.threads_per_core()));
+          out.insert(out.end(), core.begin(), core.begin() + num_siblings);
+        }
+        break;
+      case Placement::Policy::Scatter: {
+        // round-robin over (NUMA node, package) domains, compact within each
+        std::map<std::pair<unsigned,unsigned>, std::vector<unsigned> > domains;
+        for(const auto& core: cores){
+          const unsigned cpu = core.front();
+          domains[std::make_pair(node_of(cpu), topology(cpu).level_ids().back())].push_back(cpu);
+        }
+        for(size_t rank = 0 ; out.size() < cores.size() ; ++rank){
+          for(const auto& domain: domains){
+            if( rank < domain.second.size() ) out.push_back(domain.second[rank]);
+          }
+        }
+        break;
+      }
+    }
+    return out;
+  }
+  
+private:
+  std::vector<affinity::ThreadTopology> mask_topology_;
+  std::vector<unsigned> core_masks_;
+  NumaTopology numa_;
+  std::vector<unsigned> allowed_;
+  unsigned quota_;
+
+  static constexpr const char* kFileTag = "AffinityThreadPool-topology";
+  static constexpr unsigned kFileVersion = 3;
+
+  /**
+    * loads AFFINITY_TOPOLOGY_FILE if it is set and readable, otherwise reads sysfs and falls back
+    * to probing with CPUID; a freshly discovered topology is saved to AFFINITY_TOPOLOGY_FILE
+    */
+  static CpuTopology Discover(){
+    const char* path = std::getenv("AFFINITY_TOPOLOGY_FILE");
+    if( path != nullptr and *path != '\0' ){
+      std::ifstream ifs(path);
+      if( ifs ){
+        try{
+          return Load(ifs);
+        }
+        catch(std::exception& e){
+          std::cerr << path << ": " << e.what() << ", rediscovering" << std::endl;
+        }
+      }
+    }
+    CpuTopology out = ReadSysfs();
+    if( out.num_cores() == 0 ) out = Probe();
+    if( path != nullptr and *path != '\0' and out.num_cores() > 0 ){
+      // write then rename, so that concurrent processes never read a partial file
+      std::ostringstream tmp;
+      tmp << path << "." << getpid();
+      {
+        std::ofstream ofs(tmp.str().c_str());
+        out.Save(ofs);
       }
+      if( std::rename(tmp.str().c_str(), path) != 0 ){
+        std::cerr << "failed to save topology to " << path << std::endl;
+        std::remove(tmp.str().c_str());
+      }
+    }
+    return out;
+  }
+
+  /**
+    * reads core types from the hybrid pmu cpu lists (devices/cpu_core/cpus and devices/cpu_atom/cpus),
+    * falling back to cpuN/cpu_capacity where the highest capacity denotes performance cores
+    * @return core type of each cpu, all Unknown on non-hybrid machines
+    */
+  static std::vector<ThreadTopology::CoreType> ReadCoreTypes(const std::string& sysfs_root,
+                                                             const std::vector<unsigned>& online, size_t num_cpus){
+    typedef ThreadTopology::CoreType CoreType;
+    std::vector<CoreType> out(num_cpus, CoreType::Unknown);
+    std::string text;
+    std::vector<unsigned> perf, efficiency;
+    if( !util::ReadFile(sysfs_root + "/devices/cpu_core/cpus", text) and !util::ParseCpuList(text, perf)
+        and !util::ReadFile(sysfs_root + "/devices/cpu_atom/cpus", text) and !util::ParseCpuList(text, efficiency) ){
+      for(unsigned cpu: perf) if( cpu < num_cpus ) out[cpu] = CoreType::Performance;
+      for(unsigned cpu: efficiency) if( cpu < num_cpus ) out[cpu] = CoreType::Efficiency;
+      return out;
+    }
+    std::vector<unsigned> capacities(num_cpus, 0);
+    for(unsigned cpu: online){
+      std::ostringstream path;
+      path << sysfs_root << "/devices/system/cpu/cpu" << cpu << "/cpu_capacity";
+      if( ReadUnsigned(path.str(), capacities[cpu]) ) return out;
+    }
+    unsigned lowest = std::numeric_limits<unsigned>::max(), highest = 0;
+    for(unsigned cpu: online){
+      lowest = std::min(lowest, capacities[cpu]);
+      highest = std::max(highest, capacities[cpu]);
+    }
+    if( online.empty() or lowest == highest ) return out;
+    for(unsigned cpu: online){
+      out[cpu] = capacities[cpu] == highest ? CoreType::Performance : CoreType::Efficiency;
+    }
+    return out;
+  }
+
+  /**
+    * reads the cgroup of the process in the v2 hierarchy (the 0:: line) and in the v1 hierarchy of the cpu controller
+    * @param v2_path, v1_path set to the cgroup path, left empty if the process is in no such hierarchy
+    */
+  static void ReadCgroupPaths(const std::string& proc_cgroup, std::string& v2_path, std::string& v1_path){
+    std::string text;
+    if( util::ReadFile(proc_cgroup, text) ) return;
+    std::istringstream lines(text);
+    for(std::string line ; std::getline(lines, line) ; ){
+      // hierarchy-ID:controller-list:cgroup-path
+      const size_t first = line.find(':');
+      const size_t second = first == std::string::npos ? first : line.find(':', first + 1);
+      if( second == std::string::npos ) continue;
+      const std::string id = line.substr(0, first);
+      const std::string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+      const std::string path = line.substr(second + 1);
+      if( id == "0" and controllers == ",," ) v2_path = path;
+      else if( controllers.find(",cpu,") != std::string::npos ) v1_path = path;
+    }
+  }
+
+  /**
+    * @return a cgroup path and its ancestors, from the path itself up to the root of the hierarchy, without trailing '/'
+    */
+  static std::vector<std::string> CgroupAncestors(std::string path){
+    std::vector<std::string> out;
+    while( !path.empty() and path.back() == '/' ) path.pop_back();
+    for( ; ; ){
+      out.push_back(path);
+      if( path.empty() ) break;
+      path.erase(path.rfind('/') == std::string::npos ? 0 : path.rfind('/'));
+    }
+    return out;
+  }
+
+  /**
+    * @return the tighter of a quota in cpus, 0 for no limit, and quota/period rounded up
+    */
+  static unsigned TighterQuota(unsigned cpus, long long quota, long long period){
+    if( quota <= 0 or period <= 0 ) return cpus;
+    const unsigned limit = static_cast<unsigned>((quota + period - 1) / period);
+    return cpus == 0 ? limit : std::min(cpus, limit);
+  }
+
+  static bool ReadUnsigned(const std::string& path, unsigned& value){
+    std::string text;
+    if( util::ReadFile(path, text) ) return true;
+    std::istringstream iss(text);
+    return !(iss >> value);
+  }
+
+  void Index(){
+    if( numa_.empty() ) numa_ = NumaTopology::Uniform(mask_topology_.size());
+    // the allowed hyperthread with the lowest SMT id represents its core
+    std::vector<unsigned> loc_core_masks;
+    for(unsigned cpu: allowed_){
+      const auto& tp = mask_topology_[cpu];
+      if( !tp.valid() or tp.level_ids().empty() ) continue;
+      auto same_core = std::find_if(loc_core_masks.begin(), loc_core_masks.end(), [&](unsigned other){
+          return tp.distance(mask_topology_[other]) == 1;
+      });
+      if( same_core == loc_core_masks.end() ) loc_core_masks.push_back(cpu);
+      else if( tp.level_ids().front() < mask_topology_[*same_core].level_ids().front() ) *same_core = cpu;
     }
-  };
+    std::sort(loc_core_masks.begin(), loc_core_masks.end());
+    core_masks_.swap(loc_core_masks);
+  }
+
+  /**
+    * @return allowed hyperthreads (among within) of each core ordered by SMT id, cores ordered from the outermost level id
+    *         inwards so that neighbouring cores share a package (and die) where possible
+    */
+  std::vector<std::vector<unsigned> > Cores(const std::vector<unsigned>& within) const {
+    std::map<std::vector<unsigned>, std::vector<std::pair<unsigned,unsigned> > > by_core;
+    for(unsigned cpu: within){
+      if( cpu >= num_cpus() or !std::binary_search(allowed_.begin(), allowed_.end(), cpu) ) continue;
+      const auto& ids = topology(cpu).level_ids();
+      if( !topology(cpu).valid() or ids.empty() ) continue;
+      by_core[std::vector<unsigned>(ids.rbegin(), ids.rend() - 1)].emplace_back(ids.front(), cpu);
+    }
+    std::vector<std::vector<unsigned> > out;
+    out.reserve(by_core.size());
+    for(auto& core: by_core){
+      std::sort(core.second.begin(), core.second.end());
+      out.emplace_back();
+      for(const auto& entry: core.second) out.back().push_back(entry.second);
+    }
+    return out;
+  }
+
+  /**
+    * @return true if error occurs
+    */
+  static bool Pin(std::thread& thread, unsigned cpu){
+    if( cpu >= CPU_SETSIZE ) return true;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu,&cpu_set);
+    return pthread_setaffinity_np(thread.native_handle(),sizeof(cpu_set_t),&cpu_set) != 0;
+  }
 
-  static void LogTopology(std::shared_future<void> start_signal,bayolau::affinity::ThreadTopology& tp) {
+  static void LogTopology(std::shared_future<void> start_signal,const bool& failed,bayolau::affinity::ThreadTopology& tp) {
     start_signal.wait();
+    if( failed ) return; // running on an arbitrary cpu, the snapshot would be wrong
     try{
       tp.Acquire();
     }
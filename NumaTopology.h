@@ -0,0 +1,190 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef NUMA_TOPOLOGY_H
+#define NUMA_TOPOLOGY_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include "util.h"
+
+namespace bayolau {
+namespace affinity {
+
+/**
+  * NUMA nodes, the logical cpus attached to them, and the SLIT distances between them,
+  * as reported by linux under <sysfs_root>/devices/system/node
+  */
+struct NumaTopology{
+  /**
+    * reads the node layout below sysfs_root, which can point to a fake tree for testing.
+    * An empty instance is returned if the tree does not describe any node.
+    */
+  static NumaTopology Read(const std::string& sysfs_root = "/sys"){
+    NumaTopology out;
+    const std::string base = sysfs_root + "/devices/system/node/";
+    std::string text;
+    if( util::ReadFile(base + "online", text) or util::ParseCpuList(text, out.nodes_) ){
+      return NumaTopology();
+    }
+    out.cpus_.resize(out.nodes_.size());
+    out.distances_.assign(out.nodes_.size() * out.nodes_.size(), 0);
+    for(size_t nn = 0 ; nn < out.nodes_.size() ; ++nn){
+      std::ostringstream dir;
+      dir << base << "node" << out.nodes_[nn] << "/";
+      if( util::ReadFile(dir.str() + "cpulist", text) or util::ParseCpuList(text, out.cpus_[nn]) ){
+        out.cpus_[nn].clear();
+      }
+      // one entry per online node, in the order of "online"
+      std::vector<unsigned> row;
+      if( !util::ReadFile(dir.str() + "distance", text) ){
+        std::istringstream iss(text);
+        for(unsigned dd ; iss >> dd ; ) row.push_back(dd);
+      }
+      for(size_t mm = 0 ; mm < out.nodes_.size() ; ++mm){
+        out.distances_[nn * out.nodes_.size() + mm] =
+            row.size() == out.nodes_.size() ? row[mm] : DefaultDistance(nn == mm);
+      }
+    }
+    out.Index();
+    return out;
+  }
+
+  /**
+    * @return a single node 0 holding logical cpus [0,num_cpus), for machines without NUMA information
+    */
+  static NumaTopology Uniform(unsigned num_cpus){
+    NumaTopology out;
+    out.nodes_.assign(1, 0);
+    out.cpus_.resize(1);
+    for(unsigned cpu = 0 ; cpu < num_cpus ; ++cpu) out.cpus_[0].push_back(cpu);
+    out.distances_.assign(1, DefaultDistance(true));
+    out.Index();
+    return out;
+  }
+
+  /**
+    * @return ids of the online nodes, in increasing order
+    */
+  const std::vector<unsigned>& nodes() const noexcept { return nodes_; }
+  /**
+    * @return the logical cpus of a node, empty if the node is unknown
+    */
+  const std::vector<unsigned>& cpus(unsigned node) const noexcept {
+    static const std::vector<unsigned> none;
+    const size_t nn = position(node);
+    return nn < cpus_.size() ? cpus_[nn] : none;
+  }
+  /**
+    * @return the node of a logical cpu, or unsigned max if the cpu is unknown
+    */
+  unsigned node_of(unsigned cpu) const noexcept {
+    return cpu < node_of_.size() ? node_of_[cpu] : std::numeric_limits<unsigned>::max();
+  }
+  /**
+    * @return relative distance between two nodes, 10 being local by ACPI convention,
+    *         or unsigned max if either node is unknown
+    */
+  unsigned distance(unsigned from, unsigned to) const noexcept {
+    const size_t ff = position(from), tt = position(to);
+    if( ff >= nodes_.size() or tt >= nodes_.size() ) return std::numeric_limits<unsigned>::max();
+    return distances_[ff * nodes_.size() + tt];
+  }
+
+  bool empty() const noexcept { return nodes_.empty(); }
+
+  /**
+    * writes the layout in the text format read by Load
+    */
+  void Save(std::ostream& os) const {
+    os << "nodes " << nodes_.size() << "\n";
+    for(size_t nn = 0 ; nn < nodes_.size() ; ++nn){
+      os << nodes_[nn] << " " << cpus_[nn].size();
+      for(unsigned cpu: cpus_[nn]) os << " " << cpu;
+      for(size_t mm = 0 ; mm < nodes_.size() ; ++mm) os << " " << distances_[nn * nodes_.size() + mm];
+      os << "\n";
+    }
+  }
+
+  /**
+    * reads a layout written by Save, throws std::runtime_error on malformed input
+    */
+  static NumaTopology Load(std::istream& is){
+    NumaTopology out;
+    std::string tag;
+    size_t num_nodes;
+    if( !(is >> tag >> num_nodes) or tag != "nodes" ) throw std::runtime_error("malformed NUMA topology");
+    out.nodes_.resize(num_nodes);
+    out.cpus_.resize(num_nodes);
+    out.distances_.resize(num_nodes * num_nodes);
+    for(size_t nn = 0 ; nn < num_nodes ; ++nn){
+      size_t num_cpus;
+      if( !(is >> out.nodes_[nn] >> num_cpus) ) throw std::runtime_error("malformed NUMA topology");
+      out.cpus_[nn].resize(num_cpus);
+      for(auto& cpu: out.cpus_[nn]) is >> cpu;
+      for(size_t mm = 0 ; mm < num_nodes ; ++mm) is >> out.distances_[nn * num_nodes + mm];
+      if( !is ) throw std::runtime_error("malformed NUMA topology");
+    }
+    if( !std::is_sorted(out.nodes_.begin(), out.nodes_.end()) ) throw std::runtime_error("malformed NUMA topology");
+    out.Index();
+    return out;
+  }
+
+private:
+  std::vector<unsigned> nodes_;
+  std::vector<std::vector<unsigned> > cpus_; // indexed like nodes_
+  std::vector<unsigned> distances_; // row-major, indexed like nodes_
+  std::vector<unsigned> node_of_;    // indexed by logical cpu
+
+  static unsigned DefaultDistance(bool local) { return local ? 10 : 20; }
+
+  /**
+    * @return index of a node in nodes_, or nodes_.size() if it is unknown
+    */
+  size_t position(unsigned node) const noexcept {
+    const auto it = std::lower_bound(nodes_.begin(), nodes_.end(), node);
+    return it != nodes_.end() and *it == node ? it - nodes_.begin() : nodes_.size();
+  }
+
+  void Index(){
+    node_of_.clear();
+    for(size_t nn = 0 ; nn < nodes_.size() ; ++nn){
+      for(unsigned cpu: cpus_[nn]){
+        if( cpu >= node_of_.size() ) node_of_.resize(cpu + 1, std::numeric_limits<unsigned>::max());
+        node_of_[cpu] = nodes_[nn];
+      }
+    }
+  }
+};
+
+}
+}
+
+#endif
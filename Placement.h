@@ -0,0 +1,99 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <vector>
+#include <utility>
+
+namespace bayolau {
+namespace affinity {
+
+/**
+  * How the threads of a pool are laid out over logical cpus, in the spirit of KMP_AFFINITY.
+  * CpuTopology::Place turns a placement into one logical cpu per thread.
+  */
+struct Placement{
+  enum class Policy {
+    Unpinned,       // threads float, one per allowed logical cpu by default
+    Compact,        // one thread per core, neighbouring threads on neighbouring cores
+    Scatter,        // one thread per core, consecutive threads spread over packages/NUMA nodes
+    ThreadsPerCore, // up to n hyperthreads per core, siblings adjacent, e.g. n=2 for SMT pairs
+    Explicit,       // the given logical cpus, in the given order
+  };
+
+  static Placement Unpinned() { return Placement(Policy::Unpinned, 0, std::vector<unsigned>()); }
+  static Placement Compact() { return Placement(Policy::Compact, 1, std::vector<unsigned>()); }
+  static Placement Scatter() { return Placement(Policy::Scatter, 1, std::vector<unsigned>()); }
+  static Placement ThreadsPerCore(unsigned n) { return Placement(Policy::ThreadsPerCore, n, std::vector<unsigned>()); }
+  static Placement SmtPairs() { return ThreadsPerCore(2); }
+  static Placement Explicit(std::vector<unsigned> cpus) { return Placement(Policy::Explicit, 0, std::move(cpus)); }
+
+  /**
+    * set the number of threads, 0 for one per placed cpu (capped by the cgroup cpu quota unless Explicit).
+    * Extra threads wrap around the placed cpus.
+    * @return *this
+    */
+  Placement& Threads(unsigned n) { num_threads_ = n; return *this; }
+
+  /**
+    * set how many threads a pool may grow to with Resize, 0 for as many as it starts with.
+    * Only read when a pool is constructed.
+    * @return *this
+    */
+  Placement& MaxThreads(unsigned n) { max_threads_ = n; return *this; }
+
+  /**
+    * set the number of cells of each bounded injection queue, e.g. the rings of a LockFreeThreadPool,
+    * 0 for 256 per thread and at least 1024. Work pushed to a full ring spills to a mutex-based queue.
+    * Only read when a pool is constructed.
+    * @return *this
+    */
+  Placement& QueueCapacity(size_t n) { queue_capacity_ = n; return *this; }
+
+  Policy policy() const noexcept { return policy_; }
+  bool pinned() const noexcept { return policy_ != Policy::Unpinned; }
+  unsigned threads_per_core() const noexcept { return threads_per_core_; }
+  const std::vector<unsigned>& cpus() const noexcept { return cpus_; }
+  unsigned num_threads() const noexcept { return num_threads_; }
+  unsigned max_threads() const noexcept { return max_threads_; }
+  size_t queue_capacity() const noexcept { return queue_capacity_; }
+
+private:
+  Policy policy_;
+  unsigned threads_per_core_;
+  std::vector<unsigned> cpus_;
+  unsigned num_threads_;
+  unsigned max_threads_;
+  size_t queue_capacity_;
+
+  Placement(Policy policy, unsigned threads_per_core, std::vector<unsigned> cpus)
+    : policy_(policy), threads_per_core_(threads_per_core), cpus_(std::move(cpus)), num_threads_(0), max_threads_(0), queue_capacity_(0) { }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,249 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <type_traits>
+
+namespace bayolau {
+namespace memory {
+/**
+  * Per-thread free lists of fixed-size blocks, one family of lists per type T.
+  *
+  * A block is recycled into the free list of the thread which first allocated it. A block freed
+  * by any other thread goes to a lock-free "remote" list of the owner, which the owner reclaims
+  * when its local list runs dry. Producer-consumer traffic, such as a thread scheduling work
+  * for workers to run and free, therefore reaches a steady state without global heap calls.
+  *
+  * Blocks are only returned to the global heap when their owner thread has exited.
+  */
+template<typename T>
+struct FreeListPool{
+  /**
+    * @return uninitialized storage for one T
+    */
+  static void* Allocate() {
+    Cache* cache = LocalCache();
+    Block* block = cache ? cache->Pop() : nullptr;
+    if( !block ){
+      block = static_cast<Block*>(::operator new(sizeof(Block)));
+      block->owner = cache;
+    }
+    if( cache ) cache->refs.fetch_add(1, std::memory_order_relaxed);
+    block->next = nullptr;
+    return block->storage;
+  }
+
+  /**
+    * return storage obtained by Allocate(), from any thread
+    */
+  static void Deallocate(void* ptr) noexcept {
+    if( !ptr ) return;
+    Block* block = FromStorage(ptr);
+    Cache* owner = block->owner;
+    if( !owner ){
+      ::operator delete(block);
+    }
+    else if( owner == Current() ){ // freeing never creates the cache, which would allocate
+      block->next = owner->local;
+      owner->local = block;
+      owner->refs.fetch_sub(1, std::memory_order_relaxed);
+    }
+    else {
+      owner->PushRemote(block);
+    }
+  }
+
+  /**
+    * @return an intrusive link which containers may use while the object in ptr is alive
+    */
+  static void*& link(T* ptr) noexcept {
+    return FromStorage(ptr)->next;
+  }
+
+private:
+  struct Cache;
+  struct Block {
+    Cache* owner;
+    void* next; // free list link, or container link while in use
+    typename std::aligned_storage<sizeof(T),alignof(T)>::type storage[1];
+  };
+
+  /**
+    * the owner thread holds one reference, every block in use holds one reference
+    */
+  struct Cache {
+    Block* local;
+    std::atomic<Block*> remote;
+    std::atomic<size_t> refs;
+
+    Cache(): local(nullptr), remote(nullptr), refs(1) { }
+
+    Block* Pop() {
+      if( !local ){
+        local = remote.exchange(nullptr, std::memory_order_acquire);
+        if( !local ) return nullptr;
+      }
+      Block* out = local;
+      local = static_cast<Block*>(out->next);
+      return out;
+    }
+
+    void PushRemote(Block* block) noexcept {
+      Block* head = remote.load(std::memory_order_relaxed);
+      do {
+        block->next = head;
+      } while( !remote.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed) );
+      Release();
+    }
+
+    void Release() noexcept {
+      if( refs.fetch_sub(1, std::memory_order_acq_rel) == 1 ){
+        Free(remote.exchange(nullptr, std::memory_order_acquire));
+        delete this;
+      }
+    }
+
+    static void Free(Block* block) noexcept {
+      while( block ){
+        Block* next = static_cast<Block*>(block->next);
+        ::operator delete(block);
+        block = next;
+      }
+    }
+  };
+
+  /**
+    * releases the cache at thread exit, once every outstanding block has been returned
+    */
+  struct Holder {
+    Cache* cache;
+    Holder(): cache(new Cache()) { Current() = cache; }
+    ~Holder() {
+      Cache* const out = cache;
+      cache = nullptr;
+      Current() = nullptr;
+      Destroyed() = true;
+      Cache::Free(out->local);
+      out->local = nullptr;
+      Cache::Free(out->remote.exchange(nullptr, std::memory_order_acquire));
+      out->Release();
+    }
+  };
+
+  static bool& Destroyed() {
+    static thread_local bool destroyed = false;
+    return destroyed;
+  }
+
+  /**
+    * @return the calling thread's cache if it has been created, NULL otherwise
+    */
+  static Cache*& Current() {
+    static thread_local Cache* current = nullptr;
+    return current;
+  }
+
+  /**
+    * @return the calling thread's cache, created on first use, NULL during thread teardown
+    */
+  static Cache* LocalCache() {
+    if( Destroyed() ) return nullptr;
+    static thread_local Holder holder;
+    return holder.cache;
+  }
+
+  static Block* FromStorage(void* ptr) noexcept {
+    return reinterpret_cast<Block*>(static_cast<unsigned char*>(ptr) - offsetof(Block, storage));
+  }
+};
+
+/**
+  * deleter which destroys the object and recycles its storage
+  */
+template<typename T>
+struct Recycler{
+  void operator()(T* ptr) const noexcept {
+    if( !ptr ) return;
+    ptr->~T();
+    FreeListPool<T>::Deallocate(ptr);
+  }
+};
+
+template<typename T>
+using PoolPtr = std::unique_ptr<T, Recycler<T>>;
+
+/**
+  * construct a T in pooled storage
+  */
+template<typename T, typename... Args>
+PoolPtr<T> MakePooled(Args&&... args) {
+  void* storage = FreeListPool<T>::Allocate();
+  try {
+    return PoolPtr<T>(new (storage) T(std::forward<Args>(args)...));
+  }
+  catch(...) {
+    FreeListPool<T>::Deallocate(storage);
+    throw;
+  }
+}
+
+/**
+  * standard allocator over FreeListPool, for single-object allocations such as shared states.
+  * Array allocations go to the global heap.
+  */
+template<typename T>
+struct PoolAllocator{
+  typedef T value_type;
+
+  PoolAllocator() noexcept { }
+  template<typename U> PoolAllocator(const PoolAllocator<U>&) noexcept { }
+
+  T* allocate(size_t n) {
+    if( n == 1 ) return static_cast<T*>(FreeListPool<Storage>::Allocate());
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t n) noexcept {
+    if( n == 1 ) FreeListPool<Storage>::Deallocate(ptr);
+    else ::operator delete(ptr);
+  }
+
+  template<typename U> bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+  template<typename U> bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+
+private:
+  typedef typename std::aligned_storage<sizeof(T),alignof(T)>::type Storage;
+};
+
+}
+}
+
+#endif
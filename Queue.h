@@ -25,48 +25,49 @@ SOFTWARE.
 #ifndef QUEUE_H
 #define QUEUE_H
 
-#include <deque>
 #include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
 #include <memory>
 #include <utility>
 #include <iterator>
 #include <algorithm>
+#include "Pool.h"
 
 namespace bayolau {
 namespace threadsafe {
 /**
-  * A quick-and-dirty implementation of thread-safe queue.
+  * An unbounded thread-safe queue guarded by a mutex, the injection queue of ThreadPool.
+  * Elements live in pooled nodes which are linked intrusively, so that pushing and popping
+  * do not touch the global heap in steady state.
   *
-  * Will be REPLACED by a lock-free version when infrasturcture is done
+  * threadsafe::RingQueue is the bounded lock-free alternative with the same contract, used by LockFreeThreadPool.
   */
 template<typename T>
 struct Queue{
-  using DataPtr = std::unique_ptr<T>;
+  using DataPtr = memory::PoolPtr<T>;
 
   /**
-    * push values to the back of the queue
+    * push values, or DataPtr to values, to the back of the queue
     * @return true if error occurs
     */
   template<class Iterator>
   bool push(Iterator begin, Iterator end){
     const int64_t num_elements = std::distance(begin,end);
     if(num_elements < 1) return true;
-    std::vector<DataPtr> ptrs(num_elements);
-    std::transform(begin, end,
-                   ptrs.begin(),
-                   [](T&&val){
-                     return DataPtr(new T(std::forward<T>(val)));
-                   });
-    std::lock_guard<std::mutex> lg(lk_);
-    impl_.insert(impl_.end(),
-                 std::make_move_iterator(ptrs.begin()),
-                 std::make_move_iterator(ptrs.end()));
-    if(num_elements == 1) {
-      cv_.notify_one();
-    }
-    else {
-      cv_.notify_all();
+    T* head = nullptr;
+    T* tail = nullptr;
+    for(auto itr = begin ; itr != end ; ++itr){
+      T* const ptr = Adopt(std::move(*itr)).release();
+      Link(ptr) = nullptr;
+      if( tail ) Link(tail) = ptr;
+      else head = ptr;
+      tail = ptr;
     }
+    std::lock_guard<std::mutex> lg(lk_);
+    Append(head, tail);
+    Notify(num_elements);
     return false;
   }
 
@@ -75,13 +76,14 @@ struct Queue{
     * @return true if error occurs
     */
   bool push(T&& val) {
-    DataPtr ptr( new T(std::forward<T>(val)) );
-    return push(std::move(ptr));
+    return push(Adopt(std::forward<T>(val)));
   }
   bool push(DataPtr&& val) {
+    T* const ptr = val.release();
+    Link(ptr) = nullptr;
     std::lock_guard<std::mutex> lg(lk_);
-    impl_.push_back(std::forward<DataPtr>(val));
-    cv_.notify_one();
+    Append(ptr, ptr);
+    Notify(1);
     return false;
   }
 
@@ -91,10 +93,7 @@ struct Queue{
     */
   DataPtr pop() {
     std::unique_lock<std::mutex> lg(lk_);
-    if( impl_.empty()) return DataPtr();
-    DataPtr out(std::move(impl_.front()));
-    impl_.pop_front();
-    return out;
+    return PopFront();
   }
 
   /**
@@ -102,16 +101,11 @@ struct Queue{
     * @return a smart pointer to the popped element
     */
   DataPtr wait_and_pop() {
-    for( std::unique_lock<std::mutex> lg(lk_)
-       ; /*loops until return*/
-       ; cv_.wait(lg,[this]{return !impl_.empty();})
-       ){
-      if( !impl_.empty() ){
-        DataPtr out(std::move(impl_.front()));
-        impl_.pop_front();
-        return out;
-      }
-    }
+    std::unique_lock<std::mutex> lg(lk_);
+    ++num_waiters_;
+    cv_.wait(lg,[this]{return head_ != nullptr;});
+    --num_waiters_;
+    return PopFront();
   }
 
   /**
@@ -119,13 +113,56 @@ struct Queue{
     */
   bool empty() const {
     std::unique_lock<std::mutex> lg(lk_);
-    return impl_.empty();
+    return head_ == nullptr;
+  }
+
+  Queue(): head_(nullptr), tail_(nullptr), num_waiters_(0), lk_(), cv_() { }
+
+  ~Queue() {
+    while( PopFront() ) { }
   }
 
+  Queue(const Queue&) = delete;
+  Queue& operator=(const Queue&) = delete;
+
+  /**
+    * take ownership of a value or a pointer to a value
+    */
+  static DataPtr Adopt(DataPtr&& val) { return std::move(val); }
+  static DataPtr Adopt(T&& val) { return memory::MakePooled<T>(std::forward<T>(val)); }
+
 private:
-  std::deque<DataPtr> impl_;
+  T* head_;
+  T* tail_;
+  size_t num_waiters_; // guarded by lk_
   mutable std::mutex lk_;
   std::condition_variable cv_;
+
+  static void*& Link(T* ptr) noexcept {
+    return memory::FreeListPool<T>::link(ptr);
+  }
+
+  /**
+    * wake one waiter per pushed element, rather than all of them to contend for the lock
+    */
+  void Notify(size_t n) {
+    for(size_t ww = std::min(n, num_waiters_) ; ww > 0 ; --ww) cv_.notify_one();
+  }
+
+  void Append(T* head, T* tail) noexcept {
+    if( tail_ ) Link(tail_) = head;
+    else head_ = head;
+    tail_ = tail;
+  }
+
+  DataPtr PopFront() noexcept {
+    T* const out = head_;
+    if( out ){
+      head_ = static_cast<T*>(Link(out));
+      if( !head_ ) tail_ = nullptr;
+    }
+    return DataPtr(out);
+  }
 };
 
 }
@@ -0,0 +1,275 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <iterator>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include "Pool.h"
+
+namespace bayolau {
+namespace threadsafe {
+/**
+  * A bounded lock-free multi-producer multi-consumer queue, after D. Vyukov's sequence-numbered
+  * ring buffer. Each cell sits on its own cache line.
+  *
+  * It has the same contract as threadsafe::Queue, except that push fails when the ring is full.
+  * A bulk push is all-or-nothing and reserves its contiguous range of cells with a single atomic.
+  */
+template<typename T>
+struct RingQueue{
+  using DataPtr = memory::PoolPtr<T>;
+
+  /**
+    * push values, or DataPtr to values, to the back of the queue
+    * @return true if error occurs, in which case no value is consumed
+    */
+  template<class Iterator>
+  bool push(Iterator begin, Iterator end){
+    const int64_t num_elements = std::distance(begin,end);
+    if(num_elements < 1) return true;
+    if(num_elements > static_cast<int64_t>(capacity())) return true;
+
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for(bool retried = false ; ; ){
+      const size_t head = dequeue_pos_.load(std::memory_order_acquire);
+      if( pos + num_elements - head > capacity() ){
+        if( retried ) return true;
+        retried = true;
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if( enqueue_pos_.compare_exchange_weak(pos, pos + num_elements, std::memory_order_relaxed) ) break;
+    }
+    // every cell in the range has been claimed by a consumer, wait for the ones still being vacated
+    for(auto itr = begin ; itr != end ; ++itr, ++pos){
+      Cell& cell = cells_[pos & mask_];
+      while( cell.sequence.load(std::memory_order_acquire) != pos ){
+        std::this_thread::yield();
+      }
+      cell.data = Adopt(std::move(*itr)).release();
+      cell.sequence.store(pos + 1, std::memory_order_release);
+    }
+    Notify(num_elements);
+    return false;
+  }
+
+  /**
+    * push value to the back of the queue
+    * @return true if error occurs, in which case the value is not consumed
+    */
+  bool push(T&& val) {
+    static_assert( std::is_nothrow_move_constructible<T>::value,
+                   "values are moved into a claimed cell, which must then be filled" );
+    void* const storage = memory::FreeListPool<T>::Allocate(); // before claiming, so that a throw leaves no hole
+    size_t pos;
+    Cell* const cell = Claim(pos);
+    if( !cell ){
+      memory::FreeListPool<T>::Deallocate(storage);
+      return true;
+    }
+    Publish(cell, pos, new (storage) T(std::move(val)));
+    return false;
+  }
+  bool push(DataPtr&& val) {
+    size_t pos;
+    Cell* const cell = Claim(pos);
+    if( !cell ) return true;
+    Publish(cell, pos, val.release());
+    return false;
+  }
+
+  /**
+    * pop the front of the queue
+    * @return a smart pointer to the popped element if queue is nonempty, NULL otherwise
+    */
+  DataPtr pop() {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for( ; ; ){
+      cell = &cells_[pos & mask_];
+      const size_t seq = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if( diff == 0 ){
+        if( dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) ) break;
+      }
+      else if( diff < 0 ){
+        return DataPtr();
+      }
+      else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    DataPtr out(cell->data);
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return out;
+  }
+
+  /**
+    * wait until the queue is not empty, then pop
+    * @return a smart pointer to the popped element
+    */
+  DataPtr wait_and_pop() {
+    for( ; ; ){
+      for(unsigned spin = 0 ; spin < 64 ; ++spin){
+        DataPtr out = pop();
+        if( out ) return out;
+        std::this_thread::yield();
+      }
+      std::unique_lock<std::mutex> lg(lk_);
+      ++num_waiters_;
+      cv_.wait(lg,[this]{return !empty();});
+      --num_waiters_;
+    }
+  }
+
+  /**
+    * @true if queue is empty
+    */
+  bool empty() const {
+    return dequeue_pos_.load(std::memory_order_acquire) >= enqueue_pos_.load(std::memory_order_acquire);
+  }
+
+  /**
+    * @return maximum number of elements
+    */
+  size_t capacity() const noexcept { return mask_ + 1; }
+
+  /**
+    * @param capacity maximum number of elements, rounded up to a power of 2
+    */
+  explicit RingQueue(size_t capacity = 1<<16)
+    : mask_(RoundUp(capacity) - 1), storage_(), cells_(nullptr), enqueue_pos_(0), dequeue_pos_(0)
+    , num_waiters_(0), lk_(), cv_() {
+    storage_.reset(new char[sizeof(Cell) * (mask_ + 2)]);
+    void* ptr = storage_.get();
+    size_t space = sizeof(Cell) * (mask_ + 2);
+    cells_ = static_cast<Cell*>(std::align(kCacheLine, sizeof(Cell) * (mask_ + 1), ptr, space));
+    for(size_t ii = 0 ; ii <= mask_ ; ++ii){
+      new (&cells_[ii]) Cell();
+      cells_[ii].sequence.store(ii, std::memory_order_relaxed);
+    }
+  }
+
+  ~RingQueue() {
+    while( pop() ) { }
+    for(size_t ii = 0 ; ii <= mask_ ; ++ii){
+      cells_[ii].~Cell();
+    }
+  }
+
+  RingQueue(const RingQueue&) = delete;
+  RingQueue& operator=(const RingQueue&) = delete;
+
+  /**
+    * take ownership of a value or a pointer to a value
+    */
+  static DataPtr Adopt(DataPtr&& val) { return std::move(val); }
+  static DataPtr Adopt(T&& val) { return memory::MakePooled<T>(std::forward<T>(val)); }
+
+private:
+  static constexpr size_t kCacheLine = 64;
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T* data;
+    char pad[kCacheLine - sizeof(std::atomic<size_t>) - sizeof(T*)];
+    Cell(): sequence(0), data(nullptr), pad() { }
+  };
+
+  static size_t RoundUp(size_t n) {
+    size_t out = 2;
+    while( out < n ) out <<= 1;
+    return out;
+  }
+
+  /**
+    * claim the back cell
+    * @param pos set to the position of the cell
+    * @return the cell, NULL if the queue is full
+    */
+  Cell* Claim(size_t& pos) {
+    pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for( ; ; ){
+      Cell* const cell = &cells_[pos & mask_];
+      const size_t seq = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if( diff == 0 ){
+        if( enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) ) return cell;
+      }
+      else if( diff < 0 ){
+        return nullptr;
+      }
+      else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+    * fill a claimed cell and hand it to the consumers
+    */
+  void Publish(Cell* cell, size_t pos, T* data) {
+    cell->data = data;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    Notify(1);
+  }
+
+  /**
+    * wake one blocked wait_and_pop caller per pushed element, if any
+    */
+  void Notify(size_t n) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if( num_waiters_.load() == 0 ) return;
+    std::lock_guard<std::mutex> lg(lk_);
+    for(size_t ww = std::min<size_t>(n, num_waiters_.load()) ; ww > 0 ; --ww) cv_.notify_one();
+  }
+
+  const size_t mask_;
+  std::unique_ptr<char[]> storage_;
+  Cell* cells_;
+  char pad0_[kCacheLine];
+  std::atomic<size_t> enqueue_pos_;
+  char pad1_[kCacheLine - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> dequeue_pos_;
+  char pad2_[kCacheLine - sizeof(std::atomic<size_t>)];
+  std::atomic<unsigned> num_waiters_;
+  std::mutex lk_;
+  std::condition_variable cv_;
+};
+
+}
+}
+
+#endif
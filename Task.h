@@ -0,0 +1,155 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include "Pool.h"
+
+namespace bayolau {
+namespace affinity {
+/**
+  * A move-only void(void) callable, occupying one cache line.
+  * Callables of up to kInlineSize bytes which are nothrow-movable and at most pointer-aligned
+  * are stored inline, others are stored in pooled memory. Invocation is a single indirect call.
+  */
+class Task{
+public:
+  static constexpr size_t kInlineSize = 56;
+
+  Task() noexcept : ops_(nullptr) { }
+
+  template<class F, class = typename std::enable_if<
+                                 !std::is_same<typename std::decay<F>::type,Task>::value>::type>
+  Task(F&& work) : ops_(nullptr) {
+    typedef typename std::decay<F>::type Callable;
+    Construct<Callable>(std::forward<F>(work), std::integral_constant<bool,Inline<Callable>::value>());
+  }
+
+  Task(Task&& other) noexcept : ops_(other.ops_) {
+    if( ops_ ) {
+      ops_->relocate(&storage_, &other.storage_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  Task& operator=(Task&& other) noexcept {
+    if( this != &other ){
+      reset();
+      if( other.ops_ ){
+        other.ops_->relocate(&storage_, &other.storage_);
+        ops_ = other.ops_;
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  ~Task() { reset(); }
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  /**
+    * @return true if the task holds a callable
+    */
+  explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+  /**
+    * run the callable, the task must not be empty
+    */
+  void operator()() { ops_->invoke(&storage_); }
+
+  /**
+    * destroy the callable, if any
+    */
+  void reset() noexcept {
+    if( ops_ ){
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+private:
+  typedef typename std::aligned_storage<kInlineSize, alignof(void*)>::type Storage;
+
+  struct Ops {
+    void (*invoke)(void*);
+    void (*relocate)(void* dst, void* src) noexcept; // move construct dst, destroy src
+    void (*destroy)(void*) noexcept;
+  };
+
+  template<class F>
+  struct Inline: std::integral_constant<bool, sizeof(F) <= kInlineSize
+                                              and alignof(F) <= alignof(void*)
+                                              and std::is_nothrow_move_constructible<F>::value> { };
+
+  template<class F>
+  struct InlineOps {
+    static void invoke(void* self) { (*static_cast<F*>(self))(); }
+    static void relocate(void* dst, void* src) noexcept {
+      new (dst) F(std::move(*static_cast<F*>(src)));
+      static_cast<F*>(src)->~F();
+    }
+    static void destroy(void* self) noexcept { static_cast<F*>(self)->~F(); }
+    static const Ops ops;
+  };
+
+  template<class F>
+  struct PooledOps {
+    static void invoke(void* self) { (**static_cast<F**>(self))(); }
+    static void relocate(void* dst, void* src) noexcept { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+    static void destroy(void* self) noexcept { memory::Recycler<F>()(*static_cast<F**>(self)); }
+    static const Ops ops;
+  };
+
+  template<class F, class Arg>
+  void Construct(Arg&& work, std::true_type) {
+    new (&storage_) F(std::forward<Arg>(work));
+    ops_ = &InlineOps<F>::ops;
+  }
+  template<class F, class Arg>
+  void Construct(Arg&& work, std::false_type) {
+    *reinterpret_cast<F**>(&storage_) = memory::MakePooled<F>(std::forward<Arg>(work)).release();
+    ops_ = &PooledOps<F>::ops;
+  }
+
+  Storage storage_;
+  const Ops* ops_;
+};
+
+template<class F>
+const Task::Ops Task::InlineOps<F>::ops = {&InlineOps<F>::invoke, &InlineOps<F>::relocate, &InlineOps<F>::destroy};
+
+template<class F>
+const Task::Ops Task::PooledOps<F>::ops = {&PooledOps<F>::invoke, &PooledOps<F>::relocate, &PooledOps<F>::destroy};
+
+}
+}
+
+#endif
@@ -0,0 +1,212 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <cstddef>
+#include "Task.h"
+
+namespace bayolau {
+namespace affinity {
+
+template<template<typename> class InjectionQueue> class BasicThreadPool;
+
+/**
+  * A set of tasks and of dependencies between them, built once and run any number of times by a thread pool.
+  * A task is queued as soon as its last predecessor finishes, by the worker which ran that predecessor,
+  * so that it runs on the same worker while the predecessor's data are still in cache.
+  *
+  * If a task throws, the tasks depending on it, directly or not, are skipped in that run, and the
+  * exception is reported to the run's TaskGroup.
+  * A graph must not be modified or destroyed while it runs.
+  */
+class TaskGraph {
+public:
+  typedef size_t Node;
+
+  /**
+    * add a task without dependency, work need only be movable
+    * @return the task's node
+    */
+  template<class F>
+  Node Add(F&& work) {
+    works_.emplace_back(std::forward<F>(work));
+    successors_.emplace_back();
+    num_predecessors_.push_back(0);
+    checked_ = false;
+    return works_.size() - 1;
+  }
+
+  /**
+    * make after wait for before
+    * @return *this
+    */
+  TaskGraph& Precede(Node before, Node after) {
+    if( before >= size() or after >= size() ) throw std::out_of_range("no such node in task graph");
+    successors_[before].push_back(after);
+    ++num_predecessors_[after];
+    checked_ = false;
+    return *this;
+  }
+
+  /**
+    * add a task which waits for before
+    * @return the task's node
+    */
+  template<class F>
+  Node Then(Node before, F&& work) {
+    const Node out = Add(std::forward<F>(work));
+    Precede(before, out);
+    return out;
+  }
+
+  /**
+    * @return number of tasks
+    */
+  size_t size() const noexcept { return works_.size(); }
+
+  bool empty() const noexcept { return works_.empty(); }
+
+  /**
+    * @return true if the graph is being run
+    */
+  bool running() const noexcept { return running_.load(); }
+
+  TaskGraph(): works_(), successors_(), num_predecessors_(), checked_(true), counters_(), skip_(),
+               num_allocated_(0), remaining_(0), running_(false) { }
+
+  TaskGraph(const TaskGraph&) = delete;
+  TaskGraph& operator=(const TaskGraph&) = delete;
+
+private:
+  template<template<typename> class InjectionQueue> friend class BasicThreadPool;
+
+  std::vector<Task> works_; // run in place, so that a graph can be run again
+  std::vector<std::vector<Node>> successors_;
+  std::vector<size_t> num_predecessors_;
+  bool checked_; // the graph is known to be acyclic
+
+  // state of the current run
+  std::unique_ptr<std::atomic<size_t>[]> counters_; // predecessors yet to finish, per node
+  std::unique_ptr<std::atomic<bool>[]> skip_; // some predecessor failed or was skipped, per node
+  size_t num_allocated_;
+  std::atomic<size_t> remaining_; // nodes yet to finish
+  std::atomic<bool> running_;
+
+  /**
+    * prepare a run
+    * @return nodes without predecessor
+    */
+  std::vector<Node> Start() {
+    if( running_.exchange(true) ) throw std::runtime_error("task graph is already running");
+    try {
+      Check();
+    }
+    catch(...) {
+      running_ = false;
+      throw;
+    }
+    if( num_allocated_ != size() ){
+      counters_.reset(new std::atomic<size_t>[size()]);
+      skip_.reset(new std::atomic<bool>[size()]);
+      num_allocated_ = size();
+    }
+    std::vector<Node> out;
+    for(Node node = 0 ; node < size() ; ++node){
+      counters_[node] = num_predecessors_[node];
+      skip_[node] = false;
+      if( num_predecessors_[node] == 0 ) out.push_back(node);
+    }
+    remaining_ = size();
+    return out;
+  }
+
+  /**
+    * run a node, then release its successors with ready(successor) for each one whose predecessors are all done
+    * @return the exception thrown by the node's task, if any
+    */
+  template<class Ready>
+  std::exception_ptr Run(Node node, Ready ready) {
+    std::exception_ptr error;
+    const bool skip = skip_[node].load();
+    if( !skip ){
+      try {
+        works_[node]();
+      }
+      catch(...) {
+        error = std::current_exception();
+      }
+    }
+    for(const Node successor : successors_[node]){
+      if( skip or error ) skip_[successor] = true;
+      if( counters_[successor].fetch_sub(1) == 1 ) ready(successor);
+    }
+    return error;
+  }
+
+  /**
+    * mark a node as finished
+    * @return true if it was the last node of the run
+    */
+  bool Finish() {
+    if( remaining_.fetch_sub(1) != 1 ) return false;
+    running_ = false;
+    return true;
+  }
+
+  /**
+    * throw if the graph has a cycle, whose tasks could never run
+    */
+  void Check() {
+    if( checked_ ) return;
+    std::vector<size_t> counts(num_predecessors_);
+    std::vector<Node> stack;
+    for(Node node = 0 ; node < size() ; ++node){
+      if( counts[node] == 0 ) stack.push_back(node);
+    }
+    size_t num_visited = 0;
+    while( !stack.empty() ){
+      const Node node = stack.back();
+      stack.pop_back();
+      ++num_visited;
+      for(const Node successor : successors_[node]){
+        if( --counts[successor] == 0 ) stack.push_back(successor);
+      }
+    }
+    if( num_visited != size() ) throw std::runtime_error("task graph has a cycle");
+    checked_ = true;
+  }
+};
+
+}
+}
+
+#endif
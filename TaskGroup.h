@@ -0,0 +1,165 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef TASK_GROUP_H
+#define TASK_GROUP_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+#include "Task.h"
+
+namespace bayolau {
+namespace affinity {
+
+/**
+  * A completion counter shared by a group of tasks, in place of one future per task.
+  * Each task calls done() when it finishes; waiting costs an uncontended lock when the group is
+  * ready, and parks the caller on a condition variable otherwise.
+  * The first exception reported by any task is kept.
+  * then() chains work on the completion of the group, without blocking any thread.
+  */
+struct TaskGroup {
+  /**
+    * destroying TaskGroup will BLOCK until all tasks are done
+    */
+  ~TaskGroup() { wait(); }
+
+  /**
+    * register n more tasks, before they are scheduled
+    */
+  void add(size_t n = 1) noexcept { count_.fetch_add(n); }
+
+  /**
+    * mark one task as finished
+    * @param error exception escaping the task, if any
+    */
+  void done(std::exception_ptr error = nullptr) noexcept {
+    if( error and !failed_.exchange(true) ){
+      error_ = error; // published by the decrement below
+    }
+    size_t count = count_.load();
+    while( count > 1 ){
+      if( count_.compare_exchange_weak(count, count - 1) ) return;
+    }
+    // the last task finishes under the lock, which waiters take before returning,
+    // so that the group may be destroyed as soon as a waiter sees it ready
+    std::vector<Task> continuations;
+    {
+      std::lock_guard<std::mutex> lg(lk_);
+      if( count_.fetch_sub(1) != 1 ) return;
+      if( num_waiters_.load() > 0 ) cv_.notify_all();
+      continuations.swap(continuations_);
+    }
+    for(auto& continuation : continuations) continuation();
+  }
+
+  /**
+    * run continuation once all registered tasks are done, on the thread which finishes the last one,
+    * or right away if the group is ready. It must not throw.
+    */
+  void then(Task continuation) {
+    {
+      std::lock_guard<std::mutex> lg(lk_);
+      if( !ready() ){
+        continuations_.push_back(std::move(continuation));
+        return;
+      }
+    }
+    continuation();
+  }
+
+  /**
+    * @return true if all registered tasks are done. The last task may still be
+    *         finishing done(), wait() before destroying the group
+    */
+  bool ready() const noexcept { return count_.load() == 0; }
+
+  /**
+    * wait for all registered tasks to be done
+    */
+  void wait() {
+    for(unsigned spin = 0 ; spin < kSpins and !ready() ; ++spin){
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lg(lk_);
+    ++num_waiters_;
+    cv_.wait(lg, [this]{ return ready(); });
+    --num_waiters_;
+  }
+
+  /**
+    * wait for all registered tasks to be done, up to a timeout
+    * @return true if all registered tasks are done
+    */
+  template<class Rep, class Period>
+  bool wait_for(const std::chrono::duration<Rep,Period>& timeout) {
+    std::unique_lock<std::mutex> lg(lk_);
+    ++num_waiters_;
+    const bool out = cv_.wait_for(lg, timeout, [this]{ return ready(); });
+    --num_waiters_;
+    return out;
+  }
+
+  /**
+    * @return the first exception reported by a task, NULL if none. Valid once ready
+    */
+  std::exception_ptr exception() const noexcept {
+    return failed_.load() ? error_ : nullptr;
+  }
+
+  /**
+    * wait, then rethrow the first exception reported by a task, if any
+    */
+  void get() {
+    wait();
+    if( std::exception_ptr error = exception() ) std::rethrow_exception(error);
+  }
+
+  TaskGroup(): count_(0), failed_(false), error_(), num_waiters_(0), continuations_(), lk_(), cv_() { }
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+private:
+  static constexpr unsigned kSpins = 16;
+
+  std::atomic<size_t> count_;
+  std::atomic<bool> failed_;
+  std::exception_ptr error_;
+  std::atomic<unsigned> num_waiters_;
+  std::vector<Task> continuations_; // guarded by lk_
+  std::mutex lk_;
+  std::condition_variable cv_;
+};
+
+}
+}
+
+#endif
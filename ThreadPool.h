@@ -31,8 +31,34 @@ SOFTWARE.
 #include <functional>
 #include <atomic>
 #include <utility>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <fstream>
+#include <string>
+#include <iterator>
+#include <type_traits>
+#include <new>
+#include <unistd.h>
+#include <sys/syscall.h>
 #include "Queue.h"
+#include "RingQueue.h"
+#include "WorkStealingDeque.h"
+#include "Pool.h"
+#include "Arena.h"
+#include "Task.h"
+#include "TaskGroup.h"
+#include "TaskGraph.h"
+#include "TimerWheel.h"
 #include "CpuTopology.h"
+#include "Placement.h"
+#include "CoreSet.h"
 #include "util.h"
 
 namespace bayolau {
@@ -73,14 +99,24 @@ struct Futures {
     }
   }
 
+  /**
+    * @return true if all futures are ready, without blocking
+    */
+  bool ready() const {
+    for( const auto& entry : futures_ ){
+      if( entry.valid() and entry.wait_for(std::chrono::seconds(0)) != std::future_status::ready ) return false;
+    }
+    return true;
+  }
+
   /**
     * preallocated for at least n total elements
     */
   void reserve(size_t n) { futures_.reserve(n); }
 
-  Futures& operator+=(Future&& f) { log(std::forward<Future>(f)); }
+  Futures& operator+=(Future&& f) { log(std::forward<Future>(f)); return *this; }
 
-  Futures& operator+=(Futures&& fs) { log(std::forward<Futures>(fs)); }
+  Futures& operator+=(Futures&& fs) { log(std::forward<Futures>(fs)); return *this; }
 
   Futures(): futures_() { }
 
@@ -90,56 +126,430 @@ struct Futures {
 
   Futures(Futures&&fs) { futures_.swap(fs.futures_); }
 
-  Futures& operator=(Futures&&fs) { futures_.swap(fs.futures_); }
+  Futures& operator=(Futures&&fs) { futures_.swap(fs.futures_); return *this; }
 
 private:
   std::vector<Future> futures_;
 };
 
 
+
+/**
+  * How ParallelFor and ParallelReduce split their range
+  */
+enum class Partition {
+  Static,  // chunk k always runs on worker k, for cache reuse across repeated sweeps
+  Dynamic, // workers and the caller claim chunks from a shared cursor, for irregular work
+};
+
+/**
+  * Urgency of a unit of work. Workers take higher priority work first, but a waiting lower priority
+  * lane is still served regularly, so that it cannot starve.
+  */
+enum class Priority {
+  High, // latency-critical work, ahead of everything queued
+  Normal, // default
+  Background, // taken once there is no other work
+};
+
+/**
+  * What scheduling does when a pool with a capacity has that many work packages queued
+  */
+enum class Overflow {
+  Block, // the caller waits for room, running queued work meanwhile
+  Fail, // the work is not run: its future or group reports a std::runtime_error, Submit passes it to the exception handler
+  RunInline, // the caller runs the work itself
+};
+
+/**
+  * Kind of core a unit of work should run on, on hybrid processors
+  */
+enum class TaskClass {
+  Perf,       // latency-critical work, runs on performance cores
+  Background, // throughput work, runs on efficiency cores
+};
+
+/**
+  * What a worker does when it runs out of work: busy-wait on the cpu for a number of spins, then yield
+  * its core to other threads a number of times, then block until some work is queued for it.
+  * Spinning trades cpu time for the latency of waking a blocked thread, and suits workers pinned to cores
+  * of their own.
+  */
+struct IdlePolicy {
+  /**
+    * block right away
+    */
+  static IdlePolicy Park() { return IdlePolicy(0, 0); }
+  /**
+    * @param spins number of checks for work, a pause instruction apart
+    * @param yields number of checks for work, a yield apart, after spinning
+    */
+  static IdlePolicy Spin(unsigned spins = 2048, unsigned yields = 16) { return IdlePolicy(spins, yields); }
+
+  unsigned spins() const noexcept { return spins_; }
+  unsigned yields() const noexcept { return yields_; }
+
+private:
+  unsigned spins_;
+  unsigned yields_;
+
+  IdlePolicy(unsigned spins, unsigned yields) : spins_(spins), yields_(yields) { }
+};
+
+/**
+  * How a pool adds and retires workers by itself, within Placement::MaxThreads.
+  * The load is sampled once per interval by a monitor thread, which only exists while the scaling is automatic,
+  * since every worker may be blocked. A worker which runs the same work package over a whole interval while its
+  * thread sleeps in the kernel, e.g. on I/O or on a lock, counts as blocked.
+  */
+struct Scaling {
+  /**
+    * keep the number of workers, the default
+    */
+  static Scaling Fixed() { return Scaling(0, 0, std::chrono::milliseconds(0), std::chrono::milliseconds(0)); }
+  /**
+    * add one worker per blocked worker while work is queued, and one more when work keeps queuing up while every
+    * worker is busy and the machine has idle cpus; retire a worker once some worker has been idle for retire_after
+    * @param max_threads 0 for the pool's max_threads()
+    */
+  static Scaling Auto(unsigned min_threads = 1, unsigned max_threads = 0,
+                      std::chrono::milliseconds interval = std::chrono::milliseconds(10),
+                      std::chrono::milliseconds retire_after = std::chrono::milliseconds(1000)) {
+    return Scaling(min_threads, max_threads, interval, retire_after);
+  }
+
+  bool automatic() const noexcept { return interval_.count() > 0; }
+  unsigned min_threads() const noexcept { return min_threads_; }
+  unsigned max_threads() const noexcept { return max_threads_; }
+  std::chrono::milliseconds interval() const noexcept { return interval_; }
+  std::chrono::milliseconds retire_after() const noexcept { return retire_after_; }
+
+private:
+  unsigned min_threads_;
+  unsigned max_threads_;
+  std::chrono::milliseconds interval_;
+  std::chrono::milliseconds retire_after_;
+
+  Scaling(unsigned min_threads, unsigned max_threads, std::chrono::milliseconds interval, std::chrono::milliseconds retire_after)
+    : min_threads_(min_threads), max_threads_(max_threads), interval_(interval), retire_after_(retire_after) { }
+};
+
+/**
+  * Where Schedule(target, work) runs work: on one worker, or on any worker pinned to a logical cpu,
+  * sharing a cache, or on a NUMA node. Only those workers take the work unless it is Stealable.
+  */
+struct Target {
+  enum class Kind { Worker, Cpu, Cache, Node };
+
+  static Target Worker(unsigned index) { return Target(Kind::Worker, index, 0); }
+  static Target Cpu(unsigned cpu) { return Target(Kind::Cpu, cpu, 0); }
+  /**
+    * the workers sharing the cache of a level (1 for L1 etc) with cpu
+    */
+  static Target Cache(unsigned cpu, unsigned level = 3) { return Target(Kind::Cache, cpu, level); }
+  static Target Node(unsigned node) { return Target(Kind::Node, node, 0); }
+
+  /**
+    * let other workers take the work when they run out of work, instead of leaving it to the target
+    * @return *this
+    */
+  Target& Stealable(bool stealable = true) { stealable_ = stealable; return *this; }
+
+  Kind kind() const noexcept { return kind_; }
+  unsigned id() const noexcept { return id_; } // worker index, cpu, or node
+  unsigned level() const noexcept { return level_; }
+  bool stealable() const noexcept { return stealable_; }
+
+private:
+  Kind kind_;
+  unsigned id_;
+  unsigned level_;
+  bool stealable_;
+
+  Target(Kind kind, unsigned id, unsigned level) : kind_(kind), id_(id), level_(level), stealable_(false) { }
+};
+
 /**
   * A simple thread pool implementation.
   * An instance can has either 1) one thread pinned to one physical core, or 2) number
   * of threads equal to the number of logical cores (with hyperthreading)
-  * The scheduler takes a std::function<void(void)> callable as a work unit
+  * The scheduler takes any void(void) callable as a work unit, including move-only ones
+  *
+  * Each worker owns a work-stealing deque. Work scheduled from within a worker goes to its own
+  * deque and is popped LIFO; work scheduled from outside goes to an injection queue. An idle
+  * worker steals FIFO from the others, visiting SMT siblings first, then the same package,
+  * then remote packages.
+  *
+  * Work of Priority::High or Priority::Background goes to injection queues of its own, one lane per
+  * priority, which workers check before and after their normal work respectively.
   *
-  * TODO
-  * advanced scheduling will be added
-  * exception safty will be flushed out after scheduling changes
+  * The injection queue is selected by the InjectionQueue template parameter, which must
+  * follow the threadsafe::Queue contract. ThreadPool uses the mutex-based threadsafe::Queue,
+  * LockFreeThreadPool uses the bounded threadsafe::RingQueue, sized by Placement::QueueCapacity; work which
+  * finds a ring full spills to a threadsafe::Queue instead of waiting for room.
+  *
+  * An exception escaping a work unit is stored in its Future or TaskGroup, if any, and passed to the
+  * handler of SetExceptionHandler otherwise; it never terminates a worker.
   */
 
-class ThreadPool{
+template<template<typename> class InjectionQueue>
+class BasicThreadPool{
+  /**
+    * a unit of work
+    */
+  typedef Task WorkPackage;
+  typedef typename threadsafe::WorkStealingDeque<WorkPackage>::DataPtr WorkPtr;
+  static_assert( std::is_same<typename InjectionQueue<WorkPackage>::DataPtr,WorkPtr>::value,
+                 "injection queue must hand out the same pointer type as the work-stealing deque");
+
+  /**
+    * a callable and the promise of its completion, with the promise's shared state in pooled storage
+    */
+  template<class F>
+  struct Completion {
+    explicit Completion(F work)
+      : work_(std::move(work)), done_(std::allocator_arg, memory::PoolAllocator<char>()) { }
+    std::future<void> get_future() { return done_.get_future(); }
+    void operator()() {
+      try {
+        Admitted();
+        work_();
+        done_.set_value();
+      }
+      catch(...) {
+        done_.set_exception(std::current_exception());
+      }
+    }
+  private:
+    F work_;
+    std::promise<void> done_;
+  };
+
+  /**
+    * a callable which reports its completion to a TaskGroup
+    */
+  template<class F>
+  struct Membership {
+    Membership(F work, TaskGroup& group): work_(std::move(work)), group_(&group) { }
+    void operator()() {
+      try {
+        Admitted();
+        work_();
+      }
+      catch(...) {
+        group_->done(std::current_exception());
+        return;
+      }
+      group_->done();
+    }
+  private:
+    F work_;
+    TaskGroup* group_;
+  };
+
+  /**
+    * a callable without completion object, whose exceptions go to the exception handler
+    */
+  template<class F>
+  struct Submission {
+    F work;
+    void operator()() {
+      Admitted();
+      work();
+    }
+  };
+
+  /**
+    * @return a work package which runs work
+    */
+  template<class F>
+  static WorkPtr Package(F&& work) {
+    typedef typename std::decay<F>::type Callable;
+    return memory::MakePooled<WorkPackage>(Submission<Callable>{ Callable(std::forward<F>(work)) });
+  }
+
+  template<class F>
+  static WorkPtr Package(F&& work, TaskGroup& group) {
+    typedef typename std::decay<F>::type Callable;
+    group.add();
+    return memory::MakePooled<WorkPackage>(Membership<Callable>( Callable(std::forward<F>(work)), group ));
+  }
+
+  /**
+    * a continuation which queues a work package
+    */
+  struct Enqueue {
+    BasicThreadPool* pool;
+    WorkPtr wp;
+    void operator()() { pool->Push(std::move(wp)); }
+  };
+
+  /**
+    * runs one node of a task graph, then queues its successors which became ready
+    */
+  struct GraphTask {
+    BasicThreadPool* pool;
+    TaskGraph* graph;
+    TaskGraph::Node node;
+    TaskGroup* group;
+    void operator()() {
+      const std::exception_ptr error = graph->Run(node, [this](TaskGraph::Node successor){
+        pool->Push(memory::MakePooled<WorkPackage>(GraphTask{pool, graph, successor, group}));
+      });
+      graph->Finish();
+      group->done(error);
+    }
+  };
+
+  /**
+    * @return a work package which runs work and then fulfills future
+    */
+  template<class F>
+  static WorkPtr Package(F&& work, std::future<void>& future) {
+    typedef typename std::decay<F>::type Callable;
+    Completion<Callable> completion( Callable(std::forward<F>(work)) );
+    future = completion.get_future();
+    return memory::MakePooled<WorkPackage>(std::move(completion));
+  }
+
+  /**
+    * callable of a periodic timer, shared by its firings
+    */
+  struct Repeating {
+    Task work;
+    std::atomic<bool> running; // set while a firing is queued or running
+    explicit Repeating(Task&& w): work(std::move(w)), running(false) { }
+  };
+
+  /**
+    * a firing of a periodic timer
+    */
+  struct Repetition {
+    std::shared_ptr<Repeating> repeating;
+    void operator()() {
+      struct Done {
+        Repeating& repeating;
+        ~Done() { repeating.running = false; }
+      } done{*repeating};
+      repeating->work();
+    }
+  };
+
+  /**
+    * payload of a timer, a work package to queue once or a callable to queue periodically
+    */
+  struct Timed {
+    WorkPtr once;
+    std::shared_ptr<Repeating> every;
+  };
+
+  /**
+    * work reserved for some workers, never stolen
+    */
+  struct Mailbox {
+    threadsafe::Queue<WorkPackage> queue; // for the readers only
+    threadsafe::Queue<WorkPackage> open_queue; // for the readers first, any worker may steal from it
+    std::atomic<size_t> mail;
+    std::atomic<size_t> open_mail;
+    std::atomic<unsigned> readers; // number of active workers draining the mailbox
+    Mailbox(): queue(), open_queue(), mail(0), open_mail(0), readers(0) { }
+  };
+
   /**
-    * a wrapper of functor. We use a non-callable functor as termination signal
+    * per-worker state, victims are ordered by topological distance
     */
-  typedef std::packaged_task<void(void)> WorkPackage;
-  static bool Terminate(const WorkPackage& wp){ return !wp.valid(); }
+  struct WorkerState {
+    threadsafe::WorkStealingDeque<WorkPackage> deque;
+    std::vector<unsigned> victims;
+    Mailbox mailbox; // work for this worker only
+    std::vector<Mailbox*> shared; // domain and class mailboxes this worker drains, narrowest first
+    memory::Arena arena; // scratch memory of the worker
+    std::condition_variable wake; // the worker blocks on it when idle, parked or quiesced
+    bool sleeping; // blocked in Idle and not signalled yet, guarded by idle_lk_
+    std::atomic<uint64_t> runs; // work packages started and finished, odd while running one
+    std::atomic<long> tid; // kernel thread id, 0 until the thread starts
+    std::atomic<bool> waiting; // backing off in a helping wait, so not blocked by its work, for Scale
+    WorkerState(): deque(), victims(), mailbox(), shared(), arena(), wake(), sleeping(false), runs(0), tid(0), waiting(false) { }
+  };
 public:
-  typedef std::function<void(void)> Functor;
+  typedef std::function<void(void)> Functor; // any void(void) callable is accepted
   typedef typename Futures::Future Future;
 
   /**
     * Construct a threadpool
-    * @param pin_threads true to pin 1 thread to each physical core, false to create 1 thread per logical core
+    * @param pin_threads true to pin 1 thread to each allowed physical core (Placement::Compact),
+    *                    false to create 1 thread per allowed logical core (Placement::Unpinned);
+    *                    both are capped by the cgroup cpu quota
+    */
+  BasicThreadPool(bool pin_threads = true)
+    : BasicThreadPool(pin_threads ? Placement::Compact() : Placement::Unpinned()) { }
+
+  /**
+    * Construct a threadpool whose threads are laid out by a placement, e.g. Placement::Scatter()
+    * for memory-bandwidth-bound work or Placement::SmtPairs() for threads sharing data.
+    * A pinned pool reserves the cores it uses, so that pools never share cores.
+    */
+  explicit BasicThreadPool(const Placement& placement)
+    : BasicThreadPool(CoreSet(), placement) { }
+
+  /**
+    * Construct a threadpool on reserved cpus, e.g. from CpuTopology::Instance().ReserveNode(node),
+    * laid out by a placement within them. An unpinned pool floats over them.
+    * The pool holds the reservation until destruction.
     */
-  ThreadPool(bool pin_threads = true): work_queue_(), threads_(), pinned_(false)
+  explicit BasicThreadPool(CoreSet cores, const Placement& placement = Placement::Compact())
+    : lanes_(), spills_(), lane_sizes_(), spill_sizes_(), lane_skips_(), workers_(), class_mailboxes_(), domains_(), open_mail_(0), reserved_mail_(0), threads_(), cores_(std::move(cores))
+    , worker_cpus_(), pinned_(false), own_cores_(false), hybrid_(false)
+    , placement_(placement), num_active_(0), num_started_(0), quiesce_(false), num_quiesced_(0), frozen_(false), repin_lk_(), quiesced_cv_()
+    , stop_(false), capacity_(0), overflow_(Overflow::Block), pending_(0), num_idle_(0), idle_lk_(), spins_(IdlePolicy::Spin().spins()), yields_(IdlePolicy::Spin().yields())
+    , handler_lk_(), handler_(PrintException)
+    , timer_lk_(), timers_(), next_timer_(TimerWheel<Timed>::kNever), timekeeper_(nullptr), epoch_(std::chrono::steady_clock::now())
+    , scale_lk_(), scale_cv_(), scaling_(Scaling::Fixed()), monitor_(), last_runs_(), busy_samples_(0), idle_since_()
   {
-    const unsigned num_threads
-        = pin_threads ? CpuTopology::Instance().num_cores() : std::thread::hardware_concurrency();
-    threads_.reserve(num_threads);
+    const CpuTopology& topology = CpuTopology::Instance();
+    const std::vector<unsigned> cpus = Reserve(placement);
+    const unsigned num_threads = NumThreads(placement, cpus);
+    const unsigned num_slots = std::max(num_threads, placement.max_threads());
+    num_active_ = num_threads;
+    num_started_ = num_threads;
+    workers_.reserve(num_slots);
+    const size_t queue_capacity = placement.queue_capacity() > 0 ? placement.queue_capacity()
+                                : std::max<size_t>(kMinQueueCapacity, kQueueCapacityPerThread * num_slots);
+    for(size_t pp = 0 ; pp < kNumPriorities ; ++pp){
+      lanes_[pp].reset(NewLane(queue_capacity, std::is_constructible<InjectionQueue<WorkPackage>, size_t>()));
+      lane_sizes_[pp] = 0;
+      spill_sizes_[pp] = 0;
+      lane_skips_[pp] = 0;
+    }
+    for(unsigned tt = 0 ; tt < num_slots ; ++tt){
+      workers_.emplace_back(new WorkerState());
+      workers_.back()->mailbox.readers = 1;
+    }
+    worker_cpus_.assign(num_slots, std::numeric_limits<unsigned>::max());
+    last_runs_.assign(num_slots, 0);
+    BuildDomains();
+    threads_.reserve(num_slots);
     std::promise<void> start_flag;
     std::shared_future<void> sf = start_flag.get_future();
     for(unsigned tt = 0 ; tt < num_threads ; ++tt){
-      threads_.emplace_back(&ThreadPool::Worker,this,sf);
+      threads_.emplace_back(&BasicThreadPool::Worker,this,tt,sf);
     }
-    if(pin_threads){
-      CpuTopology::Instance().SetAffinity(threads_);
-      pinned_ = true;
+    if( !cpus.empty() ){
+      pinned_ = !topology.SetAffinity(threads_, cpus);
+      if( pinned_ ){
+        for(unsigned tt = 0 ; tt < num_threads ; ++tt) worker_cpus_[tt] = cpus[tt % cpus.size()];
+      }
+      else {
+        std::cerr << "WARNING: failed to pin threads to cores" << std::endl;
+      }
     }
-    start_flag.set_value();
-    if( ++num_instances() > 1){
-      std::cerr << "WARNING: more than one ThreadPool has been instantiated" << std::endl;
+    else if( !cores_.empty() ){
+      for(auto& thread: threads_) topology.Unpin(thread, cores_.cpus());
     }
+    OrderVictims();
+    BindArenas();
+    AssignMailboxes();
+    start_flag.set_value();
   }
 
   /**
@@ -147,112 +557,2025 @@ public:
     */
   template<class Iterator>
   Futures Schedule(Iterator begin, Iterator end) {
-    static_assert( std::is_same<typename Iterator::value_type,Functor>::value,
-                   "value type must be of Functor type");
+    static_assert( util::IsNullaryCallable<typename std::iterator_traits<Iterator>::value_type>::value,
+                   "value type must be callable with no argument");
     const auto num_elements = std::distance(begin,end);
     if(num_elements < 1) return Futures();
 
     Futures out; out.reserve(num_elements);
-    std::vector<WorkPackage> wps; wps.reserve(num_elements);
-    for(auto itr = begin ; itr != end ; ++itr){
-      if( static_cast<bool>(*itr) ){
-        wps.emplace_back( std::move(*itr) );
-        out.log(wps.back().get_future());
-      }
-    }
-    work_queue_.push(std::make_move_iterator(wps.begin()),
-                     std::make_move_iterator(wps.end()));
+    PushAll(begin, end, [&out](typename std::iterator_traits<Iterator>::reference work){
+      Future future;
+      WorkPtr wp = Package( std::move(work), future );
+      out.log(std::move(future));
+      return wp;
+    });
     return out;
   }
 
   /**
     * register a unit of work to be run
     */
-  Future Schedule(Functor work){
-    if( !work ) return std::future<void>();
-    WorkPackage wp(std::move(work));
-    Future out(wp.get_future());
-    work_queue_.push(std::move(wp));
+  template<class F>
+  Future Schedule(F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    Future out;
+    if( !util::NonEmpty(work) ) return out;
+    Offer(Package(std::forward<F>(work), out));
     return out;
   }
 
   /**
-    * Try to pop from work queue and work.
-    * @return true if a termination signal is not detected
+    * register units of work to be run, tracking their completion with a single group
+    * instead of one future per unit
+    * @return group
     */
-  bool TryWork() {
-    auto work_ptr = work_queue_.pop();
-    if( not work_ptr )
-      return true;
-    if( Terminate(*work_ptr) ) { // restore termination signal
-      work_queue_.push(std::move(work_ptr));
-      return false;
+  template<class Iterator>
+  TaskGroup& Schedule(TaskGroup& group, Iterator begin, Iterator end) {
+    static_assert( util::IsNullaryCallable<typename std::iterator_traits<Iterator>::value_type>::value,
+                   "value type must be callable with no argument");
+    PushAll(begin, end, [&group](typename std::iterator_traits<Iterator>::reference work){
+      return Package( std::move(work), group );
+    });
+    return group;
+  }
+
+  /**
+    * register a unit of work to be run, tracking its completion with group
+    * @return group
+    */
+  template<class F>
+  TaskGroup& Schedule(TaskGroup& group, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( util::NonEmpty(work) ) Offer(Package(std::forward<F>(work), group));
+    return group;
+  }
+
+  /**
+    * run body(i) for each i in [begin,end) and wait, running work meanwhile
+    * @param grain number of indices per chunk, 0 to pick one from the range and pool sizes
+    * @param partition Static runs chunk k on worker k, cycling through the workers if there are
+    *                  more chunks than workers; Dynamic lets the workers and the caller claim chunks
+    */
+  template<class Index, class Body>
+  void ParallelFor(Index begin, Index end, Index grain, Body body, Partition partition = Partition::Dynamic) {
+    if( !(begin < end) ) return;
+    ForChunks(static_cast<size_t>(end - begin), static_cast<size_t>(grain), partition,
+              [begin,&body](unsigned, size_t b, size_t e){
+                for(Index ii = begin + static_cast<Index>(b) ; ii != begin + static_cast<Index>(e) ; ++ii){
+                  body(ii);
+                }
+              });
+  }
+
+  /**
+    * fold [begin,end), a random access range, with op, starting from identity, in parallel.
+    * op must be associative, and is applied to both elements and partial results. It need not be commutative:
+    * each chunk is folded into a partial result of its own, and the partials are folded in range order.
+    * grain is raised as needed to keep to kMaxReduceChunksPerSlot chunks per slot, which bounds the partials.
+    * @return the reduction
+    */
+  template<class Iterator, class T, class Op>
+  T ParallelReduce(Iterator begin, Iterator end, T identity, Op op,
+                   size_t grain = 0, Partition partition = Partition::Dynamic) {
+    static_assert( std::is_base_of<std::random_access_iterator_tag,
+                                   typename std::iterator_traits<Iterator>::iterator_category>::value,
+                   "ParallelReduce needs random access iterators");
+    if( !(begin < end) ) return identity;
+    const size_t n = static_cast<size_t>(end - begin);
+    const size_t max_chunks = kMaxReduceChunksPerSlot * NumSlots();
+    const size_t chunk_size = std::max(ChunkSize(n, grain, partition, std::max(1u, num_active_.load())),
+                                       (n + max_chunks - 1) / max_chunks);
+    Padded<T> partials((n + chunk_size - 1) / chunk_size, identity);
+    ForChunks(n, chunk_size, partition,
+              [begin,&identity,&op,&partials,chunk_size](unsigned, size_t b, size_t e){
+                // [b,e) is a whole number of chunks, or all of [0,n) if the pool has no worker
+                for(size_t cc = b / chunk_size ; cc * chunk_size < e ; ++cc){
+                  T partial = identity;
+                  const Iterator last = begin + std::min(e, (cc + 1) * chunk_size);
+                  for(Iterator itr = begin + cc * chunk_size ; itr != last ; ++itr){
+                    partial = op(partial, *itr);
+                  }
+                  partials[cc] = std::move(partial);
+                }
+              });
+    T out = identity;
+    for(size_t cc = 0 ; cc < partials.size() ; ++cc){
+      out = op(out, partials[cc]);
     }
-    (*work_ptr)();
+    return out;
+  }
+
+  /**
+    * register units of work to be run, without any completion object.
+    * Exceptions escaping the work are passed to the exception handler
+    */
+  template<class Iterator>
+  void SubmitBulk(Iterator begin, Iterator end) {
+    static_assert( util::IsNullaryCallable<typename std::iterator_traits<Iterator>::value_type>::value,
+                   "value type must be callable with no argument");
+    PushAll(begin, end, [](typename std::iterator_traits<Iterator>::reference work){
+      return Package( std::move(work) );
+    });
+  }
+
+  /**
+    * register a unit of work to be run, without any completion object.
+    * Exceptions escaping the work are passed to the exception handler
+    */
+  template<class F>
+  void Submit(F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( !util::NonEmpty(work) ) return;
+    Offer(Package(std::forward<F>(work)));
+  }
+
+  /**
+    * register a unit of work to be run, unless the pool is at capacity
+    * @param out future of the work, left untouched if it was not queued
+    * @return false if the work was not queued
+    */
+  template<class F>
+  bool TrySchedule(F&& work, Future& out){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( Full() ) return false;
+    out = Schedule(std::forward<F>(work));
     return true;
   }
 
   /**
-    * wait til all tasks are done. will be replaced by futures
+    * register a unit of work to be run, without any completion object, unless the pool is at capacity
+    * @return false if the work was not queued
     */
-  void Wait()const{
-    while( !work_queue_.empty() ) {
-      std::this_thread::yield();
+  template<class F>
+  bool TrySubmit(F&& work){
+    return TrySubmit(Priority::Normal, std::forward<F>(work));
+  }
+  template<class F>
+  bool TrySubmit(Priority priority, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( Full() ) return false;
+    if( util::NonEmpty(work) ) Push(Package(std::forward<F>(work)), priority);
+    return true;
+  }
+  template<class F>
+  bool TrySubmit(const Target& target, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( Full() ) return false;
+    if( util::NonEmpty(work) ) PushTarget(target, Package(std::forward<F>(work)));
+    return true;
+  }
+
+  /**
+    * bound the number of queued work packages, those queued for a Target or TaskClass included, so that producers
+    * outrunning the workers are throttled instead of growing memory. Work queued by the pool itself, such as continuations and task graph
+    * successors, is not held back.
+    * @param capacity 0 for unbounded
+    * @param overflow what scheduling does at capacity
+    */
+  void SetCapacity(size_t capacity, Overflow overflow = Overflow::Block) noexcept {
+    overflow_ = overflow;
+    capacity_ = capacity;
+  }
+
+  /**
+    * @return maximum number of queued work packages, 0 if unbounded
+    */
+  size_t capacity() const noexcept { return capacity_.load(); }
+
+  Overflow overflow() const noexcept { return overflow_.load(); }
+
+  /**
+    * register a unit of work to be run in a priority lane, e.g. a latency-critical request
+    * which should not wait behind a large batch
+    */
+  template<class F>
+  Future Schedule(Priority priority, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    Future out;
+    if( !util::NonEmpty(work) ) return out;
+    Offer(Package(std::forward<F>(work), out), priority);
+    return out;
+  }
+
+  /**
+    * register a unit of work to be run in a priority lane, tracking its completion with group
+    * @return group
+    */
+  template<class F>
+  TaskGroup& Schedule(TaskGroup& group, Priority priority, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( util::NonEmpty(work) ) Offer(Package(std::forward<F>(work), group), priority);
+    return group;
+  }
+
+  /**
+    * register a unit of work to be run in a priority lane, without any completion object
+    */
+  template<class F>
+  void Submit(Priority priority, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( !util::NonEmpty(work) ) return;
+    Offer(Package(std::forward<F>(work)), priority);
+  }
+
+  /**
+    * register units of work to be run in a priority lane, e.g. a batch in Priority::Background,
+    * without any completion object
+    */
+  template<class Iterator>
+  void SubmitBulk(Priority priority, Iterator begin, Iterator end) {
+    static_assert( util::IsNullaryCallable<typename std::iterator_traits<Iterator>::value_type>::value,
+                   "value type must be callable with no argument");
+    PushAll(begin, end, [](typename std::iterator_traits<Iterator>::reference work){
+      return Package( std::move(work) );
+    }, priority);
+  }
+
+  /**
+    * register a unit of work to be run once every task of after is done, without blocking any thread.
+    * It is queued by the worker which finishes the last task of after, onto its own deque
+    */
+  template<class F>
+  Future Then(TaskGroup& after, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    Future out;
+    if( !util::NonEmpty(work) ) return out;
+    after.then(Enqueue{this, Package(std::forward<F>(work), out)});
+    return out;
+  }
+
+  /**
+    * register a unit of work to be run once every task of after is done, tracking its completion with group,
+    * e.g. to chain the stages of a pipeline
+    * @return group
+    */
+  template<class F>
+  TaskGroup& Then(TaskGroup& after, TaskGroup& group, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( util::NonEmpty(work) ) after.then(Enqueue{this, Package(std::forward<F>(work), group)});
+    return group;
+  }
+
+  /**
+    * run the tasks of a graph, each one as soon as its predecessors are done, tracking their completion with group.
+    * The graph can be scheduled again once the group is ready.
+    * @return group
+    */
+  TaskGroup& Schedule(TaskGroup& group, TaskGraph& graph){
+    if( graph.empty() ) return group;
+    const std::vector<TaskGraph::Node> roots = graph.Start();
+    group.add(graph.size());
+    for(const TaskGraph::Node node : roots){
+      Push(memory::MakePooled<WorkPackage>(GraphTask{this, &graph, node, &group}));
     }
+    return group;
   }
 
   /**
-    * @return the number of threads
+    * register a unit of work to be run on a worker whose core matches cls, e.g. a performance core for TaskClass::Perf.
+    * If the pool has no pinned worker on such core, e.g. on non-hybrid processors, this is the same as Schedule(work)
     */
-  unsigned num_threads() const noexcept {
-    return threads_.size();
+  template<class F>
+  Future Schedule(TaskClass cls, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    Future out;
+    if( !util::NonEmpty(work) ) return out;
+    Offer(Package(std::forward<F>(work), out), [this,cls](WorkPtr&& wp){ PushClass(cls, std::move(wp)); });
+    return out;
   }
 
   /**
-    * @return if the underlying threads are pinned
+    * register a unit of work to be run on a worker whose core matches cls, without any completion object
     */
-  bool pinned() const noexcept {
-    return pinned_;
+  template<class F>
+  void Submit(TaskClass cls, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( !util::NonEmpty(work) ) return;
+    Offer(Package(std::forward<F>(work)), [this,cls](WorkPtr&& wp){ PushClass(cls, std::move(wp)); });
   }
 
-  ~ThreadPool() {
-    std::vector<WorkPackage> kills(threads_.size());
-    work_queue_.push(std::make_move_iterator(kills.begin()),
-                     std::make_move_iterator(kills.end()));
-    for(auto&entry : threads_){
-      entry.join();
+  /**
+    * @return number of workers serving a task class
+    */
+  unsigned num_threads(TaskClass cls) const noexcept {
+    return class_mailboxes_[static_cast<size_t>(cls)].readers.load();
+  }
+
+  /**
+    * register a unit of work to be run by the workers of a target, e.g. the worker owning a partition
+    * of some data, or the workers of the NUMA node holding it.
+    * If no active pinned worker matches the target (a worker index is always matched), this is the same as Schedule(work)
+    */
+  template<class F>
+  Future Schedule(const Target& target, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    Future out;
+    if( !util::NonEmpty(work) ) return out;
+    Offer(Package(std::forward<F>(work), out), [this,&target](WorkPtr&& wp){ PushTarget(target, std::move(wp)); });
+    return out;
+  }
+
+  /**
+    * register a unit of work to be run by the workers of a target, tracking its completion with group
+    * @return group
+    */
+  template<class F>
+  TaskGroup& Schedule(TaskGroup& group, const Target& target, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( util::NonEmpty(work) ){
+      Offer(Package(std::forward<F>(work), group), [this,&target](WorkPtr&& wp){ PushTarget(target, std::move(wp)); });
     }
-    --num_instances();
+    return group;
   }
 
-  ThreadPool(const ThreadPool&) = delete;
-  ThreadPool& operator= (const ThreadPool&) = delete;
-  //move will require more safety code, keep things simple for now
-  ThreadPool(ThreadPool&&) = delete;
-  ThreadPool& operator= (ThreadPool&&) = delete;
+  /**
+    * register a unit of work to be run by the workers of a target, without any completion object
+    */
+  template<class F>
+  void Submit(const Target& target, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( !util::NonEmpty(work) ) return;
+    Offer(Package(std::forward<F>(work)), [this,&target](WorkPtr&& wp){ PushTarget(target, std::move(wp)); });
+  }
 
+  /**
+    * run a unit of work on some worker once delay has elapsed, without holding a worker meanwhile.
+    * Workers fire due timers between work packages, and one blocked worker sleeps until the next one is due.
+    * Timers have a resolution of a millisecond and never fire early. Exceptions go to the exception handler.
+    * Timers still pending on destruction are discarded.
+    * @return handle to Cancel the timer
+    */
+  template<class Rep, class Period, class F>
+  Timer ScheduleAfter(const std::chrono::duration<Rep,Period>& delay, F&& work){
+    return ScheduleAt(std::chrono::steady_clock::now() + delay, std::forward<F>(work));
+  }
 
-private:
-  threadsafe::Queue< WorkPackage > work_queue_;
-  std::vector<std::thread> threads_;
-  bool pinned_;
+  /**
+    * run a unit of work on some worker once deadline has passed, see ScheduleAfter
+    * @return handle to Cancel the timer
+    */
+  template<class Clock, class Duration, class F>
+  Timer ScheduleAt(const std::chrono::time_point<Clock,Duration>& deadline, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( !util::NonEmpty(work) ) return Timer();
+    return AddTimer(TickOf(ToSteady(deadline)), Timed{Package(std::forward<F>(work)), nullptr}, 0);
+  }
 
-  static std::atomic<unsigned>& num_instances(){
-    static std::atomic<unsigned> counter;
-    return counter;
-  };
+  /**
+    * run a unit of work every period, the first time one period from now, until the timer is cancelled.
+    * A firing is skipped while the previous one is still queued or running.
+    * @return handle to Cancel the timer
+    */
+  template<class Rep, class Period, class F>
+  Timer ScheduleEvery(const std::chrono::duration<Rep,Period>& period, F&& work){
+    static_assert( util::IsNullaryCallable<typename std::decay<F>::type>::value,
+                   "work must be callable with no argument");
+    if( !util::NonEmpty(work) ) return Timer();
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t ticks = std::max<uint64_t>(1, TickOf(start + period) - TickOf(start));
+    std::shared_ptr<Repeating> repeating = std::make_shared<Repeating>(Task(std::forward<F>(work)));
+    return AddTimer(TickOf(start + period), Timed{WorkPtr(), std::move(repeating)}, ticks);
+  }
 
-  void Worker(std::shared_future<void> start) {
-    start.wait();
-    for(bool work = true ; work ; ){
-      auto work_ptr = work_queue_.wait_and_pop();
-      work = !Terminate(*work_ptr);
-      if(work){
-        (*work_ptr)();
-      }
-    } 
+  /**
+    * stop a timer from firing again. A firing which is already queued or running still completes.
+    * @return true if the timer was pending
+    */
+  bool Cancel(const Timer& timer){
+    std::lock_guard<std::mutex> lg(timer_lk_);
+    const bool out = timers_.Cancel(timer);
+    next_timer_ = timers_.next();
+    return out;
   }
-};
+
+  /**
+    * @return number of pending timers
+    */
+  size_t num_timers() {
+    std::lock_guard<std::mutex> lg(timer_lk_);
+    return timers_.size();
+  }
+
+  typedef std::function<void(std::exception_ptr)> ExceptionHandler;
+
+  /**
+    * set the handler of exceptions escaping submitted work. It is called on the worker
+    * which ran the work, and by default prints the exception to std::cerr
+    */
+  void SetExceptionHandler(ExceptionHandler handler) {
+    std::lock_guard<std::mutex> lg(handler_lk_);
+    handler_ = std::move(handler);
+  }
+
+  /**
+    * pass an exception to the handler of SetExceptionHandler on the calling thread, e.g. one escaping work
+    * which runs outside of any work package, such as a spawned coroutine
+    */
+  void ReportException(std::exception_ptr error) {
+    ExceptionHandler handler;
+    {
+      std::lock_guard<std::mutex> lg(handler_lk_);
+      handler = handler_;
+    }
+    if( handler ) handler(error);
+  }
+
+  /**
+    * Try to pop from work queue and work.
+    * @return false once the pool is shutting down
+    */
+  bool TryWork() {
+    Help();
+    return !stop_.load();
+  }
+
+  /**
+    * wait til all queues are drained, running queued work meanwhile
+    */
+  void Wait() {
+    HelpUntil([this]{ return pending_.load() == 0 and !HasMail(); }, [](){ std::this_thread::yield(); });
+  }
+
+  /**
+    * wait til all tasks of a group are done, running queued work meanwhile.
+    * Called from a worker, it prefers the worker's own work, so that nested fork-join
+    * does not block workers.
+    */
+  void Wait(TaskGroup& group) {
+    HelpUntil([&group]{ return group.ready(); },
+              [&group]{ group.wait_for(std::chrono::microseconds(kParkMicroseconds)); });
+    group.wait(); // returns once the last task is done with the group
+  }
+
+  /**
+    * wait til all futures are ready, running queued work meanwhile
+    */
+  void Wait(Futures& futures) {
+    HelpUntil([&futures]{ return futures.ready(); }, [](){ std::this_thread::yield(); });
+  }
+  void Wait(const Future& future) {
+    HelpUntil([&future]{ return !future.valid() or future.wait_for(std::chrono::seconds(0)) == std::future_status::ready; },
+              [&future]{ future.wait_for(std::chrono::microseconds(kParkMicroseconds)); });
+  }
+
+  /**
+    * @return the number of threads started, parked ones included
+    */
+  unsigned num_threads() const noexcept {
+    return num_started_.load();
+  }
+
+  /**
+    * @return number of threads the pool may grow to, see Resize
+    */
+  unsigned max_threads() const noexcept {
+    return workers_.size();
+  }
+
+  /**
+    * @return if the underlying threads are pinned
+    */
+  bool pinned() const noexcept {
+    return pinned_;
+  }
+
+  /**
+    * @return the logical cpu a worker is pinned to, unsigned max if the pool is not pinned
+    */
+  unsigned cpu_of(unsigned worker) const noexcept {
+    return worker < worker_cpus_.size() ? worker_cpus_[worker] : std::numeric_limits<unsigned>::max();
+  }
+
+  /**
+    * @return scratch arena of the calling worker, NULL if the caller is not a worker of this pool.
+    * Its memory is local to the worker's NUMA node and only that worker may use it, e.g. for the temporaries
+    * of a task, with Reset() once they are no longer needed
+    */
+  memory::Arena* arena() const {
+    WorkerState* local = LocalWorker();
+    return local ? &local->arena : nullptr;
+  }
+
+  /**
+    * One instance of T per worker, plus one for the threads outside the pool, each on its own cache lines,
+    * e.g. for per-thread accumulators which are combined once the work is done.
+    * The instances of workers are constructed by the workers, so that their pages are local to them,
+    * and those of workers not started yet by the calling thread.
+    */
+  template<class T>
+  class WorkerLocal {
+  public:
+    explicit WorkerLocal(BasicThreadPool& pool, const T& init = T())
+      : pool_(pool), size_(pool.NumSlots()), stride_(RoundUp(sizeof(T), kCacheLine)),
+        buffer_(new unsigned char[size_ * stride_ + kCacheLine]), slots_(nullptr), constructed_(size_, false) {
+      void* ptr = buffer_.get();
+      size_t space = size_ * stride_ + kCacheLine;
+      slots_ = static_cast<unsigned char*>(std::align(kCacheLine, size_ * stride_, ptr, space));
+      const unsigned num_started = std::min(pool.num_threads(), size_ - 1);
+      for(unsigned ww = 0 ; ww < num_started ; ++ww){
+        pool.Post(ww, Package([this,ww,&init](){ Construct(ww, init); }, group_));
+      }
+      std::exception_ptr error;
+      try {
+        for(unsigned slot = num_started ; slot < size_ ; ++slot) Construct(slot, init);
+      }
+      catch(...) {
+        error = std::current_exception();
+      }
+      pool.Wait(group_); // tasks refer to this instance, finish them before unwinding
+      try {
+        if( error ) std::rethrow_exception(error);
+        group_.get();
+      }
+      catch(...) {
+        Destroy();
+        throw;
+      }
+    }
+
+    ~WorkerLocal() { Destroy(); }
+
+    WorkerLocal(const WorkerLocal&) = delete;
+    WorkerLocal& operator=(const WorkerLocal&) = delete;
+
+    /**
+      * @return instance of the calling worker, or the instance shared by all threads outside the pool
+      */
+    T& local() noexcept { return (*this)[pool_.Slot()]; }
+
+    T& operator[](unsigned slot) noexcept { return *reinterpret_cast<T*>(slots_ + slot * stride_); }
+    const T& operator[](unsigned slot) const noexcept { return *reinterpret_cast<const T*>(slots_ + slot * stride_); }
+
+    /**
+      * @return number of instances
+      */
+    unsigned size() const noexcept { return size_; }
+
+    /**
+      * fold the instances in slot order, once no work is using them
+      * @return op(...op(op(init, [0]), [1])...)
+      */
+    template<class U, class Op>
+    U Combine(U init, Op op) const {
+      for(unsigned slot = 0 ; slot < size_ ; ++slot) init = op(std::move(init), (*this)[slot]);
+      return init;
+    }
+
+    /**
+      * call f on each instance, e.g. to reset accumulators between rounds
+      */
+    template<class F>
+    void ForEach(F f) {
+      for(unsigned slot = 0 ; slot < size_ ; ++slot) f((*this)[slot]);
+    }
+
+  private:
+    BasicThreadPool& pool_;
+    const unsigned size_;
+    const size_t stride_;
+    std::unique_ptr<unsigned char[]> buffer_;
+    unsigned char* slots_;
+    std::vector<char> constructed_; // written by one thread per slot, read after the group completes
+    TaskGroup group_;
+
+    void Construct(unsigned slot, const T& init) {
+      new (slots_ + slot * stride_) T(init);
+      constructed_[slot] = true;
+    }
+
+    void Destroy() noexcept {
+      for(unsigned slot = 0 ; slot < size_ ; ++slot){
+        if( constructed_[slot] ) (*this)[slot].~T();
+      }
+    }
+
+    static size_t RoundUp(size_t n, size_t multiple) { return (n + multiple - 1) / multiple * multiple; }
+  };
+
+  /**
+    * set what workers do when they run out of work, from their next idle period on
+    */
+  void SetIdlePolicy(const IdlePolicy& policy) noexcept {
+    spins_ = policy.spins();
+    yields_ = policy.yields();
+  }
+
+  IdlePolicy idle_policy() const noexcept {
+    return IdlePolicy::Spin(spins_.load(), yields_.load());
+  }
+
+  /**
+    * @return the placement the pool currently follows
+    */
+  const Placement& placement() const noexcept {
+    return placement_;
+  }
+
+  /**
+    * @return the number of threads taking work; the others are parked by Repin
+    */
+  unsigned num_active_threads() const noexcept {
+    return num_active_.load();
+  }
+
+  /**
+    * Re-lay out the existing threads without recreating them: waits for the workers to finish their
+    * current work package, re-pins them within the pool's reserved cpus, reserving free cores first
+    * if the pool has none (or unpins them for Placement::Unpinned), and parks the workers
+    * beyond the placement's thread count, e.g. the SMT siblings when going from SmtPairs to Compact.
+    * Parked workers only run work posted to them and are reactivated by a later Repin.
+    * Queued work is kept.
+    * @return true if error occurs, e.g. some thread could not be pinned, or the call is made from a worker
+    */
+  bool Repin(const Placement& placement) {
+    if( LocalWorker() ) return true; // a worker cannot wait for itself to quiesce
+    std::lock_guard<std::mutex> repin_lg(repin_lk_);
+    {
+      std::unique_lock<std::mutex> lg(idle_lk_);
+      quiesce_ = true;
+      WakeAll();
+      quiesced_cv_.wait(lg, [this]{ return num_quiesced_ == num_started_.load(); });
+      frozen_ = true; // no work is running which could wait for mail anymore
+    }
+    const CpuTopology& topology = CpuTopology::Instance();
+    const std::vector<unsigned> cpus = Reserve(placement);
+    bool failed = placement.pinned() and cpus.empty();
+    std::fill(worker_cpus_.begin(), worker_cpus_.end(), std::numeric_limits<unsigned>::max());
+    if( cpus.empty() ){
+      for(auto& thread: threads_){
+        failed = (cores_.empty() ? topology.Unpin(thread) : topology.Unpin(thread, cores_.cpus())) or failed;
+      }
+    }
+    else {
+      failed = topology.SetAffinity(threads_, cpus) or failed;
+      for(unsigned ww = 0 ; ww < threads_.size() and !failed ; ++ww) worker_cpus_[ww] = cpus[ww % cpus.size()];
+    }
+    pinned_ = !cpus.empty() and !failed;
+    if( !pinned_ ) std::fill(worker_cpus_.begin(), worker_cpus_.end(), std::numeric_limits<unsigned>::max());
+    placement_ = placement;
+    OrderVictims();
+    BindArenas();
+    {
+      std::lock_guard<std::mutex> lg(idle_lk_);
+      num_active_ = std::min<unsigned>(NumThreads(placement, cpus), num_started_.load());
+      AssignMailboxes();
+      frozen_ = false;
+      quiesce_ = false;
+      WakeAll();
+    }
+    return failed;
+  }
+
+  /**
+    * Change the number of workers taking work to n, within [1,max_threads()], without waiting for running work.
+    * Threads are started on demand, pinned to a cpu of the placement which no other worker uses, reserving
+    * another free core first if the pool reserved its own cores, and sharing cpus only when none is left.
+    * Workers beyond n are parked as by Repin, once done with their current work package, and keep their slot.
+    * @return true if error occurs, e.g. n is out of range, some thread could not be pinned, or the call is made
+    *         from a worker while the pool is being repinned
+    */
+  bool Resize(unsigned n) {
+    std::unique_lock<std::mutex> repin_lg(repin_lk_, std::defer_lock);
+    if( LocalWorker() ){
+      if( !repin_lg.try_lock() ) return true; // a Repin in progress waits for this worker
+    }
+    else repin_lg.lock();
+    return ResizeLocked(n);
+  }
+
+  /**
+    * let the pool add and retire workers by itself, or stop doing so with Scaling::Fixed()
+    */
+  void SetScaling(const Scaling& scaling) {
+    std::thread retired;
+    {
+      std::lock_guard<std::mutex> lg(scale_lk_);
+      scaling_ = scaling;
+      busy_samples_ = 0;
+      idle_since_ = std::chrono::steady_clock::time_point();
+      if( !scaling.automatic() ) retired.swap(monitor_);
+      else if( !monitor_.joinable() ) monitor_ = std::thread(&BasicThreadPool::Monitor, this);
+      scale_cv_.notify_all();
+    }
+    if( retired.joinable() ) retired.join();
+  }
+
+  Scaling scaling() {
+    std::lock_guard<std::mutex> lg(scale_lk_);
+    return scaling_;
+  }
+
+  /**
+    * Repins a pool for the lifetime of the instance, e.g. for a section which benefits from
+    * migration/hyperthreading, and restores the previous placement on destruction
+    */
+  class ScopedAffinity {
+  public:
+    ScopedAffinity(BasicThreadPool& pool, const Placement& placement)
+      : pool_(pool), previous_(pool.placement()), failed_(pool.Repin(placement)) { }
+    ~ScopedAffinity() { pool_.Repin(previous_); }
+    /**
+      * @return true if the placement could not be applied
+      */
+    bool failed() const noexcept { return failed_; }
+    ScopedAffinity(const ScopedAffinity&) = delete;
+    ScopedAffinity& operator=(const ScopedAffinity&) = delete;
+  private:
+    BasicThreadPool& pool_;
+    const Placement previous_;
+    const bool failed_;
+  };
+
+  ~BasicThreadPool() {
+    SetScaling(Scaling::Fixed());
+    std::lock_guard<std::mutex> repin_lg(repin_lk_); // no thread is started from now on
+    {
+      // workers, parked ones included, exit once they find no more work
+      std::lock_guard<std::mutex> lg(idle_lk_);
+      num_active_ = num_started_.load();
+      stop_ = true;
+      WakeAll();
+    }
+    for(auto&entry : threads_){
+      entry.join();
+    }
+  }
+
+  BasicThreadPool(const BasicThreadPool&) = delete;
+  BasicThreadPool& operator= (const BasicThreadPool&) = delete;
+  //move will require more safety code, keep things simple for now
+  BasicThreadPool(BasicThreadPool&&) = delete;
+  BasicThreadPool& operator= (BasicThreadPool&&) = delete;
+
+
+private:
+  static constexpr size_t kNumPriorities = 3;
+  static constexpr unsigned kAging = 32; // a waiting lane is served after this many packages taken ahead of it
+  static constexpr size_t kMinQueueCapacity = 1024; // cells per bounded injection queue, unless set by the placement
+  static constexpr size_t kQueueCapacityPerThread = 256;
+  std::unique_ptr<InjectionQueue< WorkPackage >> lanes_[kNumPriorities]; // injection queues indexed by Priority
+  threadsafe::Queue< WorkPackage > spills_[kNumPriorities]; // overflow of bounded injection queues
+  std::atomic<size_t> lane_sizes_[kNumPriorities]; // work packages in a lane, spilled ones included
+  std::atomic<size_t> spill_sizes_[kNumPriorities];
+  std::atomic<unsigned> lane_skips_[kNumPriorities]; // packages taken ahead of a non-empty lane
+  static constexpr size_t kBatchSize = 64; // work packages per bulk injection
+  static constexpr unsigned kParkMicroseconds = 100; // helping waits rescan the queues this often
+  static constexpr unsigned kMaxHelpDepth = 8;
+  static constexpr size_t kCacheLine = 64;
+  static constexpr size_t kMaxReduceChunksPerSlot = 8; // bounds the partial results of ParallelReduce
+  static constexpr size_t kNumClasses = 2;
+  std::vector<std::unique_ptr<WorkerState>> workers_;
+  Mailbox class_mailboxes_[kNumClasses]; // indexed by TaskClass
+  static constexpr unsigned kCpuLevel = 0; // domain levels besides cache levels
+  static constexpr unsigned kNodeLevel = 0x100;
+  typedef std::pair<unsigned,unsigned> DomainKey; // (level, cpu/cache id/node)
+  std::map<DomainKey, std::unique_ptr<Mailbox>> domains_; // fixed after construction
+  std::atomic<size_t> open_mail_; // stealable mail across all mailboxes
+  std::atomic<size_t> reserved_mail_; // mail which is not stealable, across all mailboxes
+  std::vector<std::thread> threads_;
+  CoreSet cores_; // cpus reserved for this pool, empty if it has none
+  std::vector<unsigned> worker_cpus_; // logical cpu of each worker slot, unsigned max if not pinned
+  bool pinned_;
+  bool own_cores_; // cores_ was reserved by the pool itself, which may reserve more
+  bool hybrid_; // started workers sit on both performance and efficiency cores
+  Placement placement_;
+  std::atomic<unsigned> num_active_; // workers [0,num_active_) take work, the others are parked
+  std::atomic<unsigned> num_started_; // workers [0,num_started_) have a thread, the others only a slot
+  std::atomic<bool> quiesce_; // set by Repin to stop all workers between work packages
+  size_t num_quiesced_; // guarded by idle_lk_
+  bool frozen_; // every worker has quiesced and Repin is laying them out, guarded by idle_lk_
+  std::mutex repin_lk_;
+  std::condition_variable quiesced_cv_;
+  std::atomic<bool> stop_; // set on destruction
+  std::atomic<size_t> capacity_; // of queued work packages, 0 if unbounded
+  std::atomic<Overflow> overflow_;
+  std::atomic<size_t> pending_; // number of queued work packages, across all queues
+  std::atomic<unsigned> num_idle_; // workers blocked in Idle
+  std::mutex idle_lk_;
+  std::atomic<unsigned> spins_; // IdlePolicy
+  std::atomic<unsigned> yields_;
+  std::mutex handler_lk_;
+  ExceptionHandler handler_;
+  static constexpr unsigned kTimerMicroseconds = 1000; // timer resolution
+  std::mutex timer_lk_;
+  TimerWheel<Timed> timers_; // guarded by timer_lk_, in ticks of kTimerMicroseconds since epoch_
+  std::atomic<uint64_t> next_timer_; // tick at which timers_ next needs service, kNever if empty
+  WorkerState* timekeeper_; // blocked worker waiting for the next timer, guarded by idle_lk_
+  const std::chrono::steady_clock::time_point epoch_;
+  static constexpr unsigned kGrowSamples = 2; // consecutive samples of queued-up work before growing
+  std::mutex scale_lk_;
+  std::condition_variable scale_cv_;
+  Scaling scaling_; // guarded by scale_lk_, as are the monitor and the sampling states below
+  std::thread monitor_; // samples the load while scaling_ is automatic
+  std::vector<uint64_t> last_runs_; // WorkerState::runs of each worker at the last sample
+  unsigned busy_samples_;
+  std::chrono::steady_clock::time_point idle_since_; // of the first sample in a row with idle workers, if any
+
+  static void PrintException(std::exception_ptr error) {
+    try {
+      std::rethrow_exception(error);
+    }
+    catch(std::exception& e) {
+      std::cerr << "ERROR: exception escaped submitted work: " << e.what() << std::endl;
+    }
+    catch(...) {
+      std::cerr << "ERROR: unknown exception escaped submitted work" << std::endl;
+    }
+  }
+
+  /**
+    * run one queued work package, if any
+    * @return true if work was done
+    */
+  bool Help() {
+    WorkerState* const local = LocalWorker();
+    auto work_ptr = HelpDepth() < kMaxHelpDepth ? FindWork(local) : FindLocalWork(local);
+    if( not work_ptr )
+      return false;
+    ++HelpDepth();
+    Run(*work_ptr);
+    --HelpDepth();
+    return true;
+  }
+
+  /**
+    * number of helping waits nested on the calling thread. Past kMaxHelpDepth, a wait only runs
+    * the waiter's own local work, which bounds stack growth without blocking its children.
+    */
+  static unsigned& HelpDepth() {
+    static thread_local unsigned depth = 0;
+    return depth;
+  }
+
+  /**
+    * run queued work until done() holds, calling backoff() whenever no work is found
+    */
+  template<class Done, class Backoff>
+  void HelpUntil(Done done, Backoff backoff) {
+    WorkerState* const local = LocalWorker();
+    while( !done() ){
+      if( Help() ) continue;
+      if( local ) local->waiting.store(true, std::memory_order_relaxed);
+      backoff();
+      if( local ) local->waiting.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+    * run a work package, passing escaped exceptions to the handler
+    */
+  void Run(WorkPackage& work) {
+    try {
+      work();
+    }
+    catch(...) {
+      ReportException(std::current_exception());
+    }
+  }
+
+  /**
+    * @return true if the pool has a capacity and that many work packages are queued, reserved mail included
+    */
+  bool Full() const noexcept {
+    const size_t capacity = capacity_.load(std::memory_order_relaxed);
+    return capacity > 0
+       and pending_.load(std::memory_order_relaxed) + reserved_mail_.load(std::memory_order_relaxed) >= capacity;
+  }
+
+  /**
+    * queue a work package scheduled by the user, applying the overflow policy if the pool is full
+    */
+  void Offer(WorkPtr&& wp, Priority priority = Priority::Normal) {
+    Offer(std::move(wp), [this,priority](WorkPtr&& queued){ Push(std::move(queued), priority); });
+  }
+  template<class Enqueuer>
+  void Offer(WorkPtr&& wp, Enqueuer queue) {
+    if( Full() ){
+      switch( overflow_.load() ){
+        case Overflow::Block:
+          HelpUntil([this]{ return !Full(); }, [](){ std::this_thread::yield(); });
+          break;
+        case Overflow::Fail:
+          Rejecting() = true;
+          Run(*wp); // reports the error to the work's completion object instead of running it
+          Rejecting() = false;
+          return;
+        case Overflow::RunInline:
+          Run(*wp);
+          return;
+      }
+    }
+    queue(std::move(wp));
+  }
+
+  /**
+    * set while a work package is run only to report that it was not admitted
+    */
+  static bool& Rejecting() {
+    static thread_local bool rejecting = false;
+    return rejecting;
+  }
+
+  /**
+    * throw if the work package being run was not admitted
+    */
+  static void Admitted() {
+    if( Rejecting() ) throw std::runtime_error("thread pool is at capacity");
+  }
+
+  /**
+    * queue one work package, locally if called from a worker, in its priority lane otherwise
+    * or if it is not of Priority::Normal
+    */
+  void Push(WorkPtr&& wp, Priority priority = Priority::Normal) {
+    WorkerState* const local = priority == Priority::Normal ? LocalWorker() : nullptr;
+    PushCounted(1, [&]{
+      if( local ) local->deque.push(std::move(wp));
+      else Inject(std::move(wp), priority);
+    });
+  }
+
+  /**
+    * queue a work package made of each non-empty element, in batches if called from outside the pool
+    */
+  template<class Iterator, class Make>
+  void PushAll(Iterator begin, Iterator end, Make make, Priority priority = Priority::Normal) {
+    WorkerState* const local = priority == Priority::Normal ? LocalWorker() : nullptr;
+    WorkPtr batch[kBatchSize];
+    size_t num_batched = 0;
+    for(auto itr = begin ; itr != end ; ++itr){
+      if( !util::NonEmpty(*itr) ) continue;
+      if( Full() ){
+        // queue what is batched, then apply the overflow policy one package at a time
+        InjectBatch(batch, num_batched, priority);
+        num_batched = 0;
+        Offer(make(*itr), priority);
+        continue;
+      }
+      if( local ) {
+        PushCounted(1, [&]{ local->deque.push(make(*itr)); });
+        continue;
+      }
+      batch[num_batched++] = make(*itr);
+      if( num_batched == kBatchSize ){
+        InjectBatch(batch, num_batched, priority);
+        num_batched = 0;
+      }
+    }
+    InjectBatch(batch, num_batched, priority);
+  }
+
+  /**
+    * queue a batch of work packages in a priority lane
+    */
+  void InjectBatch(WorkPtr* batch, size_t num_batched, Priority priority) {
+    PushCounted(num_batched, [&]{
+      Inject(std::make_move_iterator(batch), std::make_move_iterator(batch + num_batched), priority);
+    });
+  }
+
+  /**
+    * queue n work packages with publish(), then signal idle workers. They are counted in pending_ first, so that
+    * a worker taking one at once never drops the count below zero, and uncounted again if publish() throws
+    */
+  template<class Publish>
+  void PushCounted(size_t n, Publish publish) {
+    if( n == 0 ) return;
+    pending_ += n;
+    try {
+      publish();
+    }
+    catch(...) {
+      pending_ -= n;
+      throw;
+    }
+    Notify(n);
+  }
+
+  /**
+    * identifies the pool and worker index of the calling thread
+    */
+  struct WorkerContext {
+    const BasicThreadPool* pool;
+    unsigned index;
+  };
+  static WorkerContext& Context(){
+    static thread_local WorkerContext context = {nullptr,0};
+    return context;
+  }
+
+  /**
+    * @return state of the calling thread if it is a worker of this pool, NULL otherwise
+    */
+  WorkerState* LocalWorker() const {
+    const WorkerContext& context = Context();
+    return context.pool == this ? workers_[context.index].get() : nullptr;
+  }
+
+  /**
+    * bind the arena of each pinned worker to the NUMA node of its cpu, when there are several nodes
+    */
+  void BindArenas() {
+    for(unsigned ww = 0 ; ww < workers_.size() ; ++ww) BindArena(ww);
+  }
+  void BindArena(unsigned ww) {
+    const CpuTopology& topology = CpuTopology::Instance();
+    const bool numa = topology.numa().nodes().size() > 1;
+    workers_[ww]->arena.Bind(numa and pinned_ ? topology.node_of(cpu_of(ww)) : std::numeric_limits<unsigned>::max());
+  }
+
+  /**
+    * order each worker's victims by topological distance, ties broken round-robin.
+    * Slots without a thread yet come last.
+    */
+  void OrderVictims() {
+    for(unsigned ww = 0 ; ww < workers_.size() ; ++ww) OrderVictims(ww);
+  }
+  void OrderVictims(unsigned ww) {
+    const unsigned num_workers = workers_.size();
+    const CpuTopology& topology = CpuTopology::Instance();
+    std::vector<std::pair<unsigned,unsigned>> order; order.reserve(num_workers);
+    for(unsigned offset = 1 ; offset < num_workers ; ++offset){
+      const unsigned victim = (ww + offset) % num_workers;
+      const unsigned distance = victim >= num_started_.load() ? std::numeric_limits<unsigned>::max()
+                              : pinned_ ? topology.distance(cpu_of(ww), cpu_of(victim)) : 0;
+      order.emplace_back(distance, offset);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const std::pair<unsigned,unsigned>& a, const std::pair<unsigned,unsigned>& b){
+                       return a.first < b.first;
+                     });
+    auto& victims = workers_[ww]->victims;
+    victims.clear(); victims.reserve(order.size());
+    for(const auto& entry : order){
+      victims.push_back( (ww + entry.second) % num_workers );
+    }
+  }
+
+  static InjectionQueue<WorkPackage>* NewLane(size_t capacity, std::true_type) { return new InjectionQueue<WorkPackage>(capacity); }
+  static InjectionQueue<WorkPackage>* NewLane(size_t, std::false_type) { return new InjectionQueue<WorkPackage>(); }
+
+  /**
+    * push to the injection queue of a priority lane, or to its spill queue if a bounded queue is full.
+    * Spilled work is taken once the lane's queue is empty, so FIFO order only holds until a spill.
+    */
+  void Inject(WorkPtr&& wp, Priority priority = Priority::Normal) {
+    const size_t lane = static_cast<size_t>(priority);
+    ++lane_sizes_[lane];
+    if( lanes_[lane]->push(std::move(wp)) ){
+      ++spill_sizes_[lane];
+      spills_[lane].push(std::move(wp));
+    }
+  }
+  template<class Iterator>
+  void Inject(Iterator begin, Iterator end, Priority priority = Priority::Normal) {
+    const size_t lane = static_cast<size_t>(priority);
+    if( begin == end ) return;
+    const size_t n = std::distance(begin, end);
+    lane_sizes_[lane] += n; // before the packages can be taken, as in pending_
+    if( !lanes_[lane]->push(begin, end) ) return;
+    lane_sizes_[lane] -= n;
+    for(auto itr = begin ; itr != end ; ++itr){
+      Inject(std::move(*itr), priority);
+    }
+  }
+
+  /**
+    * @return a work package from the injection queue of a lane, NULL if none was found
+    */
+  WorkPtr PopLane(Priority priority) {
+    const size_t lane = static_cast<size_t>(priority);
+    WorkPtr out;
+    if( lane_sizes_[lane].load(std::memory_order_relaxed) == 0 ) return out;
+    out = lanes_[lane]->pop();
+    if( !out and spill_sizes_[lane].load(std::memory_order_relaxed) > 0 and (out = spills_[lane].pop()) ) --spill_sizes_[lane];
+    if( out ) --lane_sizes_[lane];
+    return out;
+  }
+
+  /**
+    * take from a lower priority lane which has waited for kAging packages
+    * @param priority set to the lane of the work package
+    * @return a work package, NULL if no lane is due
+    */
+  WorkPtr PopAged(Priority& priority) {
+    WorkPtr out;
+    for(size_t lane = kNumPriorities - 1 ; !out and lane > 0 ; --lane){
+      if( lane_skips_[lane].load(std::memory_order_relaxed) < kAging ) continue;
+      priority = static_cast<Priority>(lane);
+      if( (out = PopLane(priority)) or lane_sizes_[lane].load() == 0 ) lane_skips_[lane] = 0;
+    }
+    return out;
+  }
+
+  /**
+    * count a work package of some priority against the non-empty lanes of lower priority
+    */
+  void Age(Priority priority) {
+    for(size_t lane = static_cast<size_t>(priority) + 1 ; lane < kNumPriorities ; ++lane){
+      if( lane_sizes_[lane].load(std::memory_order_relaxed) > 0 ) lane_skips_[lane].fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+    * add a timer, waking a blocked worker if it is due before the ones it waits for
+    */
+  Timer AddTimer(uint64_t due, Timed&& timed, uint64_t period) {
+    Timer out;
+    bool earlier;
+    {
+      std::lock_guard<std::mutex> lg(timer_lk_);
+      out = timers_.Add(due, std::move(timed), period);
+      const uint64_t next = timers_.next();
+      earlier = next < next_timer_.load();
+      next_timer_ = next;
+    }
+    if( earlier and num_idle_.load() > 0 ){
+      std::lock_guard<std::mutex> lg(idle_lk_);
+      if( timekeeper_ ) Wake(*timekeeper_);
+      else WakeActive(1);
+    }
+    return out;
+  }
+
+  /**
+    * sample the load once per interval of scaling_, until SetScaling retires the monitor thread
+    */
+  void Monitor() {
+    std::unique_lock<std::mutex> lg(scale_lk_);
+    while( monitor_.get_id() == std::this_thread::get_id() ){
+      if( scale_cv_.wait_for(lg, scaling_.interval()) == std::cv_status::timeout
+          and monitor_.get_id() == std::this_thread::get_id() ) Scale();
+    }
+  }
+
+  /**
+    * resize towards the load: add a worker for each one blocked in the kernel, e.g. on I/O, while work is queued,
+    * add one more once work keeps queuing up behind busy workers for kGrowSamples samples, and retire one once
+    * some have been idle for retire_after. Must be called with scale_lk_ held
+    */
+  void Scale() {
+    const CpuTopology& topology = CpuTopology::Instance();
+    const unsigned active = num_active_.load();
+    const unsigned blocked = NumBlocked(active);
+    const size_t pending = pending_.load();
+    unsigned sleeping = 0;
+    {
+      std::lock_guard<std::mutex> idle_lg(idle_lk_);
+      for(unsigned ww = 0 ; ww < active ; ++ww) sleeping += workers_[ww]->sleeping ? 1 : 0;
+    }
+    unsigned target = active;
+    if( pending > 0 and blocked > 0 ) target += blocked;
+    busy_samples_ = pending > active - blocked and sleeping == 0 ? busy_samples_ + 1 : 0;
+    if( busy_samples_ >= kGrowSamples ){
+      const size_t concurrency = cores_.empty() or own_cores_ ? topology.concurrency() : std::min(cores_.size(), topology.concurrency());
+      if( active - blocked < concurrency ) target = std::max(target, active + 1);
+      busy_samples_ = 0;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if( pending == 0 and blocked == 0 and sleeping > 0 ){
+      if( idle_since_ == std::chrono::steady_clock::time_point() ) idle_since_ = now;
+      else if( now - idle_since_ >= scaling_.retire_after() ){
+        target = std::min(target, active - 1);
+        idle_since_ = now;
+      }
+    }
+    else idle_since_ = std::chrono::steady_clock::time_point();
+    const unsigned hi = scaling_.max_threads() > 0 ? std::min<unsigned>(scaling_.max_threads(), workers_.size()) : workers_.size();
+    const unsigned lo = std::min(std::max(1u, scaling_.min_threads()), hi);
+    target = std::min(std::max(target, lo), hi);
+    if( target == active ) return;
+    std::unique_lock<std::mutex> repin_lg(repin_lk_, std::try_to_lock);
+    if( repin_lg.owns_lock() and ResizeLocked(target) ){
+      std::cerr << "WARNING: failed to resize the thread pool to " << target << " threads" << std::endl;
+    }
+  }
+
+  /**
+    * @return number of active workers which are running the same work package as at the last sample
+    *         and are sleeping in the kernel, other than in a helping wait of the pool itself
+    */
+  unsigned NumBlocked(unsigned active) {
+    unsigned out = 0;
+    for(unsigned ww = 0 ; ww < active ; ++ww){
+      const WorkerState& worker = *workers_[ww];
+      const uint64_t runs = worker.runs.load(std::memory_order_relaxed);
+      if( runs % 2 == 1 and runs == last_runs_[ww] and Sleeping(worker.tid.load())
+          and !worker.waiting.load(std::memory_order_relaxed) ) ++out;
+      last_runs_[ww] = runs;
+    }
+    return out;
+  }
+
+  /**
+    * @return true if a thread of this process is in interruptible or uninterruptible sleep, per /proc
+    */
+  static bool Sleeping(long tid) {
+    if( tid <= 0 ) return false;
+    std::ifstream stat("/proc/self/task/" + std::to_string(tid) + "/stat");
+    std::string line;
+    if( !std::getline(stat, line) ) return false;
+    const size_t paren = line.rfind(')'); // the command name may contain anything
+    return paren != std::string::npos and paren + 2 < line.size() and (line[paren + 2] == 'S' or line[paren + 2] == 'D');
+  }
+
+  /**
+    * queue the work of due timers, unless another thread is doing so
+    */
+  void ExpireTimers() {
+    if( !TimerDue() ) return;
+    std::vector<WorkPtr> fired;
+    {
+      std::unique_lock<std::mutex> lg(timer_lk_, std::try_to_lock);
+      if( !lg.owns_lock() ) return;
+      timers_.Advance(Tick(), [&fired](Timed& timed){
+        if( timed.once ) fired.push_back(std::move(timed.once));
+        else if( !timed.every->running.exchange(true) ) fired.push_back(memory::MakePooled<WorkPackage>(Repetition{timed.every}));
+      });
+      next_timer_ = timers_.next();
+    }
+    for(auto& wp : fired) Push(std::move(wp));
+  }
+
+  /**
+    * @return true if some timer may be due
+    */
+  bool TimerDue() const {
+    const uint64_t next = next_timer_.load(std::memory_order_relaxed);
+    return next != TimerWheel<Timed>::kNever and next <= Tick();
+  }
+
+  /**
+    * @return current tick of timers_
+    */
+  uint64_t Tick() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch_).count() / kTimerMicroseconds;
+  }
+
+  /**
+    * @return first tick of timers_ at or after deadline, so that timers never fire early
+    */
+  uint64_t TickOf(std::chrono::steady_clock::time_point deadline) const {
+    if( deadline <= epoch_ ) return 0;
+    const uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(deadline - epoch_).count();
+    return (us + kTimerMicroseconds - 1) / kTimerMicroseconds;
+  }
+
+  std::chrono::steady_clock::time_point TimeOf(uint64_t tick) const {
+    return epoch_ + std::chrono::microseconds(tick * kTimerMicroseconds);
+  }
+
+  template<class Clock, class Duration>
+  static std::chrono::steady_clock::time_point ToSteady(const std::chrono::time_point<Clock,Duration>& deadline) {
+    return std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(deadline - Clock::now());
+  }
+  static std::chrono::steady_clock::time_point ToSteady(std::chrono::steady_clock::time_point deadline) {
+    return deadline;
+  }
+
+  /**
+    * signal that n work packages, already counted in pending_, have been queued
+    */
+  void Notify(size_t n) {
+    if( n == 0 ) return;
+    if( num_idle_.load() > 0 ){
+      std::lock_guard<std::mutex> lg(idle_lk_);
+      WakeActive(n);
+    }
+  }
+
+  /**
+    * signal up to n blocked active workers, one per work package rather than all of them.
+    * Must be called with idle_lk_ held
+    */
+  void WakeActive(size_t n) {
+    const unsigned num_active = num_active_.load();
+    for(unsigned ww = 0 ; ww < num_active and n > 0 ; ++ww){
+      if( Wake(*workers_[ww]) ) --n;
+    }
+  }
+
+  /**
+    * signal a blocked worker which drains mailbox, e.g. its owner
+    * Must be called with idle_lk_ held
+    * @return true if some worker was signalled
+    */
+  bool WakeReader(const Mailbox& mailbox) {
+    for(const auto& worker : workers_){
+      if( !worker->sleeping ) continue;
+      if( &worker->mailbox == &mailbox
+          or std::find(worker->shared.begin(), worker->shared.end(), &mailbox) != worker->shared.end() ){
+        return Wake(*worker);
+      }
+    }
+    return false;
+  }
+
+  /**
+    * @return true if the worker was blocked and got signalled
+    */
+  static bool Wake(WorkerState& worker) {
+    if( !worker.sleeping ) return false;
+    worker.sleeping = false;
+    worker.wake.notify_one();
+    return true;
+  }
+
+  /**
+    * signal all workers, e.g. for them to quiesce. Must be called with idle_lk_ held
+    */
+  void WakeAll() {
+    for(const auto& worker : workers_){
+      worker->sleeping = false;
+      worker->wake.notify_one();
+    }
+  }
+
+  /**
+    * @return true if a worker has something to do: work it may take, a change of state, or a quiesce request.
+    * Parked workers only take work from their own mailbox.
+    */
+  bool Ready(unsigned index, const WorkerState* local) const {
+    if( quiesce_.load() or stop_.load() or local->mailbox.mail.load() > 0 ) return true;
+    if( index >= num_active_.load() ) return local->mailbox.open_mail.load() > 0;
+    if( pending_.load() > 0 or TimerDue() ) return true;
+    for(const Mailbox* mailbox: local->shared){
+      if( mailbox->mail.load() > 0 ) return true;
+    }
+    return false;
+  }
+
+  /**
+    * busy-wait for work as long as the idle policy allows, before blocking in Idle
+    * @return true if the worker has something to do
+    */
+  bool Spin(unsigned index, const WorkerState* local) const {
+    if( index >= num_active_.load() ) return false; // parked workers block right away
+    for(unsigned ss = spins_.load(std::memory_order_relaxed) ; ss > 0 ; --ss){
+      if( Ready(index, local) ) return true;
+      util::CpuRelax();
+    }
+    for(unsigned yy = yields_.load(std::memory_order_relaxed) ; yy > 0 ; --yy){
+      if( Ready(index, local) ) return true;
+      std::this_thread::yield();
+    }
+    return false;
+  }
+
+  /**
+    * block until some work package has been queued for local, or the worker is asked to quiesce.
+    * Whoever queues work signals the worker directly, so that a blocked worker is only woken for work
+    * it can take.
+    */
+  void Idle(unsigned index, WorkerState* local) {
+    std::unique_lock<std::mutex> lg(idle_lk_);
+    ++num_idle_;
+    while( !Ready(index, local) ){
+      if( timekeeper_ == local and index >= num_active_.load() ){
+        timekeeper_ = nullptr; // parked by Resize
+        WakeActive(1);
+      }
+      local->sleeping = true;
+      const uint64_t next = next_timer_.load();
+      if( next != TimerWheel<Timed>::kNever and index < num_active_.load() and (!timekeeper_ or timekeeper_ == local) ){
+        timekeeper_ = local; // one blocked worker waits for the next timer, the others only for work
+        local->wake.wait_until(lg, TimeOf(next));
+      }
+      else {
+        local->wake.wait(lg);
+      }
+    }
+    local->sleeping = false;
+    if( timekeeper_ == local ){
+      timekeeper_ = nullptr;
+      if( next_timer_.load() != TimerWheel<Timed>::kNever and !TimerDue() ) WakeActive(1); // hand the timers over
+    }
+    --num_idle_;
+  }
+
+  /**
+    * reserve cores for a pinned placement if the pool has none yet
+    * @return the cpus of the placement within the pool's reservation, empty if the placement is Unpinned
+    *         or no core could be reserved
+    */
+  std::vector<unsigned> Reserve(const Placement& placement) {
+    if( !placement.pinned() ) return std::vector<unsigned>();
+    const CpuTopology& topology = CpuTopology::Instance();
+    if( cores_.empty() ){
+      cores_ = topology.Reserve(placement, placement.num_threads() > 0 ? placement.num_threads() : topology.concurrency());
+      own_cores_ = !cores_.empty();
+    }
+    const std::vector<unsigned> out = cores_.empty() ? std::vector<unsigned>() : topology.Place(placement, cores_.cpus());
+    if( out.empty() ){
+      std::cerr << "WARNING: no free core to pin to, using unpinned threads" << std::endl;
+    }
+    return out;
+  }
+
+  /**
+    * see Resize. Must be called with repin_lk_ held
+    */
+  bool ResizeLocked(unsigned n) {
+    if( n == 0 or n > workers_.size() or stop_.load() ) return true;
+    const bool failed = Start(n);
+    n = std::min(n, num_started_.load());
+    std::vector<Mailbox*> orphans;
+    {
+      std::lock_guard<std::mutex> lg(idle_lk_);
+      const unsigned active = num_active_.load();
+      for(unsigned ww = active ; ww < n ; ++ww) Enlist(ww);
+      for(unsigned ww = n ; ww < active ; ++ww) Delist(ww, orphans);
+      num_active_ = n;
+      // the reactivated ones to take work, the parked ones to hand over the timers they may keep
+      for(unsigned ww = std::min(active, n) ; ww < std::max(active, n) ; ++ww) Wake(*workers_[ww]);
+    }
+    for(Mailbox* mailbox: orphans) DrainOrphan(*mailbox);
+    return failed;
+  }
+
+  /**
+    * create the threads of slots [num_threads(),n), parked until ResizeLocked activates them
+    * Must be called with repin_lk_ held
+    * @return true if error occurs, i.e. a thread could not be created or pinned; threads created are kept
+    */
+  bool Start(unsigned n) {
+    const CpuTopology& topology = CpuTopology::Instance();
+    for(unsigned ww = num_started_.load() ; ww < n ; ++ww){
+      const unsigned cpu = pinned_ ? NextCpu() : std::numeric_limits<unsigned>::max();
+      if( pinned_ and cpu == std::numeric_limits<unsigned>::max() ) return true;
+      {
+        std::lock_guard<std::mutex> lg(idle_lk_);
+        worker_cpus_[ww] = cpu;
+        Enroll(ww);
+      }
+      OrderVictims(ww);
+      BindArena(ww);
+      std::promise<void> start_flag;
+      try {
+        threads_.emplace_back(&BasicThreadPool::Worker, this, ww, start_flag.get_future().share());
+      }
+      catch(const std::system_error&){
+        return true;
+      }
+      bool failed = false;
+      if( pinned_ ) failed = topology.Unpin(threads_.back(), std::vector<unsigned>(1, cpu));
+      else if( !cores_.empty() ) failed = topology.Unpin(threads_.back(), cores_.cpus());
+      num_started_ = ww + 1;
+      start_flag.set_value();
+      if( failed ) return true;
+    }
+    return false;
+  }
+
+  /**
+    * @return the cpu of the placement used by the fewest started workers, earliest in placement order,
+    *         after reserving another core if all are used and the pool reserved its cores itself;
+    *         unsigned max if the placement has no cpu
+    */
+  unsigned NextCpu() {
+    const CpuTopology& topology = CpuTopology::Instance();
+    std::vector<unsigned> cpus = topology.Place(placement_, cores_.cpus());
+    std::vector<unsigned> uses = Uses(cpus);
+    if( own_cores_ and std::find(uses.begin(), uses.end(), 0u) == uses.end() ){
+      CoreSet more = topology.Reserve(placement_, 1);
+      if( !more.empty() ){
+        cores_.Merge(std::move(more));
+        cpus = topology.Place(placement_, cores_.cpus());
+        uses = Uses(cpus);
+      }
+    }
+    if( cpus.empty() ) return std::numeric_limits<unsigned>::max();
+    return cpus[std::min_element(uses.begin(), uses.end()) - uses.begin()];
+  }
+
+  /**
+    * @return number of started workers on each of cpus
+    */
+  std::vector<unsigned> Uses(const std::vector<unsigned>& cpus) const {
+    std::vector<unsigned> out(cpus.size(), 0);
+    for(unsigned ww = 0 ; ww < num_started_.load() ; ++ww){
+      const auto itr = std::find(cpus.begin(), cpus.end(), cpu_of(ww));
+      if( itr != cpus.end() ) ++out[itr - cpus.begin()];
+    }
+    return out;
+  }
+
+  /**
+    * report to Repin and block until it is done. Until every worker has reported, mail posted to this
+    * worker is handed back to be run, since work still running elsewhere may wait for it, e.g. for the
+    * chunks of a static ParallelFor or the construction of a WorkerLocal
+    * @return a work package from the worker's mailbox, NULL once Repin is done
+    */
+  WorkPtr Quiesce(WorkerState* local) {
+    std::unique_lock<std::mutex> lg(idle_lk_);
+    ++num_quiesced_;
+    ++num_idle_; // for Post to signal the worker
+    quiesced_cv_.notify_all();
+    WorkPtr out;
+    while( quiesce_.load() and (frozen_ or !(out = PopMail(local->mailbox))) ){
+      local->sleeping = true;
+      local->wake.wait(lg);
+    }
+    local->sleeping = false;
+    --num_idle_;
+    --num_quiesced_;
+    return out;
+  }
+
+  /**
+    * @return number of workers for a placement resolved to cpus, before capping by the pool size
+    */
+  unsigned NumThreads(const Placement& placement, const std::vector<unsigned>& cpus) const {
+    if( placement.num_threads() > 0 ) return placement.num_threads();
+    const CpuTopology& topology = CpuTopology::Instance();
+    return cpus.empty() ? (cores_.empty() ? topology.concurrency() : std::min(cores_.size(), topology.concurrency()))
+         : placement.policy() == Placement::Policy::Explicit ? cpus.size()
+         : std::min(cpus.size(), topology.concurrency());
+  }
+
+  /**
+    * queue a work package for one worker only
+    */
+  void Post(unsigned worker, WorkPtr&& wp) {
+    Post(workers_[worker]->mailbox, std::move(wp));
+  }
+
+  /**
+    * queue a work package for the readers of a mailbox, or for anyone once the readers run out of work if stealable.
+    * Reserved mail racing with a Repin which leaves the mailbox without reader is moved to the normal queues.
+    */
+  void Post(Mailbox& target, WorkPtr&& wp, bool stealable = false) {
+    // counted before the package can be taken, so that no count drops below zero
+    if( stealable ){
+      ++pending_;
+      ++open_mail_;
+      ++target.open_mail;
+      target.open_queue.push(std::move(wp));
+    }
+    else {
+      ++reserved_mail_;
+      ++target.mail;
+      target.queue.push(std::move(wp));
+      if( target.readers.load() == 0 ){
+        if( WorkPtr orphan = PopMail(target, false) ) Push(std::move(orphan));
+        return;
+      }
+    }
+    if( num_idle_.load() > 0 ){
+      std::lock_guard<std::mutex> lg(idle_lk_);
+      if( !WakeReader(target) and stealable ) WakeActive(1);
+    }
+  }
+
+  /**
+    * @return true if any mailbox has reserved mail
+    */
+  bool HasMail() const {
+    return reserved_mail_.load() > 0;
+  }
+
+  /**
+    * @return a work package from the mailbox of local, then from its shared mailboxes, NULL if none was found
+    */
+  WorkPtr PopMail(WorkerState* local) {
+    WorkPtr out;
+    if( local ){
+      out = PopMail(local->mailbox);
+      for(auto itr = local->shared.begin() ; !out and itr != local->shared.end() ; ++itr){
+        out = PopMail(**itr);
+      }
+    }
+    return out;
+  }
+
+  /**
+    * @param open whether to look at stealable mail too
+    * @return a work package from a mailbox, reserved mail first, NULL if none was found
+    */
+  WorkPtr PopMail(Mailbox& mailbox, bool open = true) {
+    WorkPtr out;
+    if( mailbox.mail.load(std::memory_order_relaxed) > 0 and (out = mailbox.queue.pop()) ){
+      --mailbox.mail;
+      --reserved_mail_;
+    }
+    else if( open and mailbox.open_mail.load(std::memory_order_relaxed) > 0 and (out = mailbox.open_queue.pop()) ){
+      --mailbox.open_mail;
+      --open_mail_;
+      --pending_;
+    }
+    return out;
+  }
+
+  /**
+    * take stealable mail from any mailbox
+    * @return a work package, NULL if none was found
+    */
+  WorkPtr StealMail() {
+    WorkPtr out;
+    if( open_mail_.load() == 0 ) return out;
+    for(auto itr = workers_.begin() ; !out and itr != workers_.end() ; ++itr){
+      out = PopOpenMail((*itr)->mailbox);
+    }
+    for(auto itr = domains_.begin() ; !out and itr != domains_.end() ; ++itr){
+      out = PopOpenMail(*itr->second);
+    }
+    for(size_t cc = 0 ; !out and cc < kNumClasses ; ++cc){
+      out = PopOpenMail(class_mailboxes_[cc]);
+    }
+    return out;
+  }
+  WorkPtr PopOpenMail(Mailbox& mailbox) {
+    WorkPtr out;
+    if( mailbox.open_mail.load(std::memory_order_relaxed) > 0 and (out = mailbox.open_queue.pop()) ){
+      --mailbox.open_mail;
+      --open_mail_;
+      --pending_;
+    }
+    return out;
+  }
+
+  /**
+    * queue a work package for the workers serving cls, or for any worker if there is none
+    */
+  void PushClass(TaskClass cls, WorkPtr&& wp) {
+    Mailbox& mailbox = class_mailboxes_[static_cast<size_t>(cls)];
+    if( mailbox.readers.load() > 0 ) Post(mailbox, std::move(wp));
+    else Push(std::move(wp));
+  }
+
+  /**
+    * queue a work package for the workers of a target, or for any worker if there is none
+    */
+  void PushTarget(const Target& target, WorkPtr&& wp) {
+    Mailbox* mailbox = nullptr;
+    switch( target.kind() ){
+      case Target::Kind::Worker:
+        if( target.id() < num_started_.load() ) mailbox = &workers_[target.id()]->mailbox;
+        break;
+      case Target::Kind::Cpu:
+        mailbox = Domain(DomainKey(kCpuLevel, target.id()));
+        break;
+      case Target::Kind::Cache: {
+        const CpuTopology& topology = CpuTopology::Instance();
+        if( target.id() < topology.num_cpus() ){
+          mailbox = Domain(DomainKey(target.level(), topology.topology(target.id()).cache_id(target.level())));
+        }
+        break;
+      }
+      case Target::Kind::Node:
+        mailbox = Domain(DomainKey(kNodeLevel, target.id()));
+        break;
+    }
+    if( mailbox and mailbox->readers.load() > 0 ) Post(*mailbox, std::move(wp), target.stealable());
+    else Push(std::move(wp));
+  }
+
+  /**
+    * @return the mailbox of a domain, NULL if the pool has none
+    */
+  Mailbox* Domain(const DomainKey& key) {
+    auto itr = domains_.find(key);
+    return itr == domains_.end() ? nullptr : itr->second.get();
+  }
+
+  /**
+    * create one mailbox per allowed logical cpu, per data/unified cache and per NUMA node,
+    * so that the set never changes while work is being scheduled
+    */
+  void BuildDomains() {
+    const CpuTopology& topology = CpuTopology::Instance();
+    for(unsigned cpu: topology.allowed_cpus()){
+      for(const DomainKey& key: DomainsOf(cpu)){
+        if( !domains_.count(key) ) domains_[key].reset(new Mailbox());
+      }
+    }
+  }
+
+  /**
+    * @return domains of a logical cpu, narrowest first
+    */
+  static std::vector<DomainKey> DomainsOf(unsigned cpu) {
+    const CpuTopology& topology = CpuTopology::Instance();
+    std::vector<DomainKey> out;
+    if( cpu >= topology.num_cpus() or !topology.topology(cpu).valid() ) return out;
+    out.emplace_back(kCpuLevel, cpu);
+    std::vector<unsigned> levels;
+    for(const auto& cache: topology.topology(cpu).caches()){
+      if( cache.type != ThreadTopology::CacheType::Instruction ) levels.push_back(cache.level);
+    }
+    std::sort(levels.begin(), levels.end());
+    levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+    for(unsigned level: levels) out.emplace_back(level, topology.topology(cpu).cache_id(level));
+    if( topology.node_of(cpu) != std::numeric_limits<unsigned>::max() ) out.emplace_back(kNodeLevel, topology.node_of(cpu));
+    return out;
+  }
+
+  /**
+    * let each active pinned worker drain the mailboxes of its domains and task class,
+    * then move reserved mail left without reader to the normal queues
+    */
+  void AssignMailboxes() {
+    for(auto& domain: domains_) domain.second->readers = 0;
+    for(auto& mailbox: class_mailboxes_) mailbox.readers = 0;
+    hybrid_ = false;
+    if( pinned_ ){
+      // over the cpus of the placement rather than the current workers, as Resize does not revisit them
+      const CpuTopology& topology = CpuTopology::Instance();
+      bool performance = false, efficiency = false;
+      for(unsigned cpu: topology.Place(placement_, cores_.cpus())){
+        performance = performance or topology.core_type(cpu) == ThreadTopology::CoreType::Performance;
+        efficiency = efficiency or topology.core_type(cpu) == ThreadTopology::CoreType::Efficiency;
+      }
+      hybrid_ = performance and efficiency;
+    }
+    for(unsigned ww = 0 ; ww < workers_.size() ; ++ww){
+      Enroll(ww);
+      if( ww < num_active_.load() ) Enlist(ww);
+    }
+    for(auto& domain: domains_) DrainOrphan(*domain.second);
+    for(auto& mailbox: class_mailboxes_) DrainOrphan(mailbox);
+  }
+  void DrainOrphan(Mailbox& mailbox) {
+    if( mailbox.readers.load() > 0 ) return;
+    while( WorkPtr orphan = PopMail(mailbox, false) ) Push(std::move(orphan));
+  }
+
+  /**
+    * set the mailboxes a pinned worker drains while active: those of its domains, and on hybrid processors
+    * that of TaskClass::Perf on performance cores or TaskClass::Background on efficiency cores.
+    * Only while the worker has no thread or is quiesced, as it reads them unguarded.
+    */
+  void Enroll(unsigned ww) {
+    auto& shared = workers_[ww]->shared;
+    shared.clear();
+    if( !pinned_ or cpu_of(ww) == std::numeric_limits<unsigned>::max() ) return;
+    for(const DomainKey& key: DomainsOf(cpu_of(ww))){
+      if( Mailbox* mailbox = Domain(key) ) shared.push_back(mailbox);
+    }
+    if( !hybrid_ ) return;
+    switch( CpuTopology::Instance().core_type(cpu_of(ww)) ){
+      case ThreadTopology::CoreType::Performance: shared.push_back(&class_mailboxes_[static_cast<size_t>(TaskClass::Perf)]); break;
+      case ThreadTopology::CoreType::Efficiency: shared.push_back(&class_mailboxes_[static_cast<size_t>(TaskClass::Background)]); break;
+      default: break;
+    }
+  }
+
+  /**
+    * count an activated worker among the readers of its mailboxes
+    */
+  void Enlist(unsigned ww) {
+    for(Mailbox* mailbox: workers_[ww]->shared) ++mailbox->readers;
+  }
+
+  /**
+    * stop counting a parked worker among the readers of its mailboxes
+    * @param orphans receives the mailboxes left without reader, to be drained with DrainOrphan
+    */
+  void Delist(unsigned ww, std::vector<Mailbox*>& orphans) {
+    for(Mailbox* mailbox: workers_[ww]->shared){
+      if( --mailbox->readers == 0 ) orphans.push_back(mailbox);
+    }
+  }
+
+  /**
+    * number of partial result slots used by ForChunks
+    */
+  unsigned NumSlots() const noexcept { return workers_.size() + 1; }
+
+  /**
+    * @return the WorkerLocal slot of the calling thread: its worker index, or the last slot outside the pool
+    */
+  unsigned Slot() const noexcept {
+    const WorkerContext& context = Context();
+    return context.pool == this ? context.index : workers_.size();
+  }
+
+  /**
+    * a fixed number of instances, each on cache lines of its own, so that workers writing neighbours do not
+    * share a line
+    */
+  template<class T>
+  class Padded {
+  public:
+    Padded(size_t size, const T& init)
+      : size_(0), stride_((sizeof(T) + kCacheLine - 1) / kCacheLine * kCacheLine),
+        buffer_(new unsigned char[size * stride_ + kCacheLine]), items_(nullptr) {
+      static_assert( alignof(T) <= kCacheLine, "instances are aligned to cache lines only" );
+      void* ptr = buffer_.get();
+      size_t space = size * stride_ + kCacheLine;
+      items_ = static_cast<unsigned char*>(std::align(kCacheLine, size * stride_, ptr, space));
+      try {
+        for( ; size_ < size ; ++size_) new (items_ + size_ * stride_) T(init);
+      }
+      catch(...) {
+        Destroy();
+        throw;
+      }
+    }
+    ~Padded() { Destroy(); }
+
+    Padded(const Padded&) = delete;
+    Padded& operator=(const Padded&) = delete;
+
+    T& operator[](size_t ii) noexcept { return *reinterpret_cast<T*>(items_ + ii * stride_); }
+    size_t size() const noexcept { return size_; }
+
+  private:
+    size_t size_; // constructed instances
+    const size_t stride_;
+    std::unique_ptr<unsigned char[]> buffer_;
+    unsigned char* items_;
+
+    void Destroy() noexcept {
+      for(size_t ii = 0 ; ii < size_ ; ++ii) (*this)[ii].~T();
+    }
+  };
+
+  /**
+    * @return number of indices per chunk of ForChunks: grain if set, else one chunk per worker for
+    *         Partition::Static and about 8 per slot for Partition::Dynamic
+    */
+  size_t ChunkSize(size_t n, size_t grain, Partition partition, unsigned num_workers) const noexcept {
+    if( grain > 0 ) return grain;
+    return partition == Partition::Static ? (n + num_workers - 1) / num_workers
+                                          : std::max<size_t>(1, n / (8 * NumSlots()));
+  }
+
+  /**
+    * split [0,n) into chunks and run chunk(slot,b,e) over them, in parallel, then wait.
+    * slot is in [0,NumSlots()) and no two chunks run concurrently with the same slot.
+    */
+  template<class Chunk>
+  void ForChunks(size_t n, size_t grain, Partition partition, Chunk chunk) {
+    const unsigned num_workers = num_active_.load();
+    if( num_workers == 0 ){
+      chunk(0, 0, n);
+      return;
+    }
+    TaskGroup group;
+    std::exception_ptr error;
+    const size_t chunk_size = ChunkSize(n, grain, partition, num_workers);
+    if( partition == Partition::Static ){
+      const size_t num_chunks = (n + chunk_size - 1) / chunk_size;
+      for(unsigned ww = 0 ; ww < num_workers and ww < num_chunks ; ++ww){
+        Post(ww, Package([&chunk,ww,n,chunk_size,num_chunks,num_workers](){
+          for(size_t cc = ww ; cc < num_chunks ; cc += num_workers){
+            chunk(ww, cc * chunk_size, std::min(n, (cc + 1) * chunk_size));
+          }
+        }, group));
+      }
+      Wait(group);
+    }
+    else {
+      std::atomic<size_t> cursor(0);
+      auto claim = [&chunk,&cursor,n,chunk_size](unsigned slot){
+        for(size_t b ; (b = cursor.fetch_add(chunk_size)) < n ; ){
+          chunk(slot, b, std::min(n, b + chunk_size));
+        }
+      };
+      const unsigned num_tasks = std::min<size_t>(num_workers, (n + chunk_size - 1) / chunk_size);
+      for(unsigned tt = 0 ; tt < num_tasks ; ++tt){
+        Push(Package([&claim,tt](){ claim(tt); }, group));
+      }
+      try {
+        claim(num_workers);
+      }
+      catch(...) {
+        error = std::current_exception();
+      }
+      Wait(group); // tasks refer to this frame, finish them before unwinding
+    }
+    if( error ) std::rethrow_exception(error);
+    group.get();
+  }
+
+  /**
+    * look for work in the local deque only
+    * @return a work package, NULL if none was found
+    */
+  WorkPtr FindLocalWork(WorkerState* local) {
+    WorkPtr out;
+    if( local ) out = local->deque.pop();
+    if( out ) --pending_;
+    else out = PopMail(local);
+    return out;
+  }
+
+  /**
+    * look for work in a lane due for aging, the high priority lane, the local deque, the local mailbox,
+    * the normal priority lane, other workers, then the background lane
+    * @return a work package, NULL if none was found
+    */
+  WorkPtr FindWork(WorkerState* local) {
+    Priority priority = Priority::Normal;
+    WorkPtr out = PopAged(priority);
+    if( !out and (out = PopLane(Priority::High)) ) priority = Priority::High;
+    if( !out and local ) out = local->deque.pop();
+    if( !out and (out = PopMail(local)) ){
+      Age(Priority::Normal);
+      return out;
+    }
+    if( !out ) out = PopLane(Priority::Normal);
+    if( !out ) {
+      if( local ){
+        for(const unsigned victim : local->victims){
+          if( (out = workers_[victim]->deque.steal()) ) break;
+        }
+      }
+      else {
+        for(const auto& worker : workers_){
+          if( (out = worker->deque.steal()) ) break;
+        }
+      }
+    }
+    if( !out and (out = PopLane(Priority::Background)) ) priority = Priority::Background;
+    if( out ){
+      --pending_;
+      Age(priority);
+    }
+    else out = StealMail();
+    return out;
+  }
+
+  void Worker(unsigned index, std::shared_future<void> start) {
+    start.wait();
+    Context().pool = this;
+    Context().index = index;
+    WorkerState* const local = workers_[index].get();
+    local->tid = syscall(SYS_gettid);
+    for( ; ; ){
+      WorkPtr work_ptr;
+      if( quiesce_.load() ){
+        work_ptr = Quiesce(local);
+        if( !work_ptr ) continue;
+      }
+      else if( index < num_active_.load() ){
+        ExpireTimers();
+        work_ptr = FindWork(local);
+      }
+      else work_ptr = PopMail(local->mailbox); // parked
+      if( work_ptr ){
+        local->runs.fetch_add(1, std::memory_order_relaxed); // odd while running, for Scale
+        Run(*work_ptr);
+        local->runs.fetch_add(1, std::memory_order_relaxed);
+      }
+      else if( stop_.load() ){
+        break;
+      }
+      else if( !Spin(index, local) ){
+        Idle(index, local);
+      }
+    }
+    Context().pool = nullptr;
+  }
+};
+
+template<template<typename> class InjectionQueue>
+constexpr size_t BasicThreadPool<InjectionQueue>::kBatchSize;
+template<template<typename> class InjectionQueue>
+constexpr size_t BasicThreadPool<InjectionQueue>::kNumPriorities;
+template<template<typename> class InjectionQueue>
+constexpr size_t BasicThreadPool<InjectionQueue>::kMinQueueCapacity;
+template<template<typename> class InjectionQueue>
+constexpr size_t BasicThreadPool<InjectionQueue>::kQueueCapacityPerThread;
+template<template<typename> class InjectionQueue>
+constexpr unsigned BasicThreadPool<InjectionQueue>::kAging;
+template<template<typename> class InjectionQueue>
+constexpr unsigned BasicThreadPool<InjectionQueue>::kParkMicroseconds;
+template<template<typename> class InjectionQueue>
+constexpr unsigned BasicThreadPool<InjectionQueue>::kMaxHelpDepth;
+template<template<typename> class InjectionQueue>
+constexpr size_t BasicThreadPool<InjectionQueue>::kNumClasses;
+template<template<typename> class InjectionQueue>
+constexpr unsigned BasicThreadPool<InjectionQueue>::kCpuLevel;
+template<template<typename> class InjectionQueue>
+constexpr unsigned BasicThreadPool<InjectionQueue>::kNodeLevel;
+template<template<typename> class InjectionQueue>
+constexpr unsigned BasicThreadPool<InjectionQueue>::kTimerMicroseconds;
+template<template<typename> class InjectionQueue>
+constexpr unsigned BasicThreadPool<InjectionQueue>::kGrowSamples;
+template<template<typename> class InjectionQueue>
+constexpr size_t BasicThreadPool<InjectionQueue>::kMaxReduceChunksPerSlot;
+
+typedef BasicThreadPool<threadsafe::Queue> ThreadPool;
+typedef BasicThreadPool<threadsafe::RingQueue> LockFreeThreadPool;
 
 }
 }
@@ -29,23 +29,88 @@ SOFTWARE.
 #include <vector>
 #include <cstring>
 #include <string>
+#include <ostream>
+#include <limits>
+#include <algorithm>
+#include <utility>
 
 namespace bayolau {
 namespace affinity {
 
 struct ThreadTopology{
   /**
-      @return a list of id of the hardware thread. The 1st/2nd/3rd entry is typically the HT/core/package ID.
+      cache type encoding of CPUID leaf 4
+   */
+  enum class CacheType : unsigned { Data = 1, Instruction = 2, Unified = 3 };
+  /**
+      one cache seen by the hardware thread; hardware threads with the same id at a level share the cache
+   */
+  struct Cache{
+    unsigned level;
+    CacheType type;
+    unsigned id;
+  };
+
+  /**
+      level type encoding of CPUID leaf 0xB/0x1F, plus Package for the outermost id
+   */
+  enum class LevelType : unsigned { Smt = 1, Core = 2, Module = 3, Tile = 4, Die = 5, DieGroup = 6, Package = 0x100 };
+
+  /**
+      core type of hybrid parts, encoded as in CPUID leaf 0x1A
+   */
+  enum class CoreType : unsigned { Unknown = 0, Efficiency = 0x20, Performance = 0x40 };
+
+  /**
+      @return a list of id of the hardware thread. The 1st/2nd/3rd entry is typically the HT/core/package ID,
+              on parts enumerating more levels, module/tile/die ids come between core and package.
    */
   const std::vector<unsigned>& level_ids() const noexcept { return level_ids_; }
   /**
-      @return the 2xAPIC ID of the hardware thread
+      @return the type of each entry of level_ids
+   */
+  const std::vector<LevelType>& level_types() const noexcept { return level_types_; }
+  /**
+      @return the 2xAPIC ID of the hardware thread, or unsigned max if it was not acquired through CPUID
    */
   unsigned u2xapic() const noexcept { return u2xapic_; }
+  /**
+      @return whether the hardware thread sits on a performance or an efficiency core, Unknown on non-hybrid parts
+   */
+  CoreType core_type() const noexcept { return core_type_; }
+  /**
+      @return caches seen by the hardware thread, from L1 outwards
+   */
+  const std::vector<Cache>& caches() const noexcept { return caches_; }
+  /**
+      @return id of the data or unified cache at a level (1 for L1 etc), or unsigned max if there is none
+   */
+  unsigned cache_id(unsigned level) const noexcept {
+    for(const auto& entry: caches_){
+      if( entry.level == level and entry.type != CacheType::Instruction ) return entry.id;
+    }
+    return std::numeric_limits<unsigned>::max();
+  }
   /**
       @return true if the instance contains a successfully snap shot of a hardware thread
    */
   bool valid() const noexcept { return valid_; }
+  /**
+      @return 0 if both are the same hardware thread, otherwise 1 + the highest level at which the ids differ,
+              e.g. 1 for SMT siblings, 2 for cores in the same package, 3 for different packages
+              when HT/core/package are the only levels.
+              Invalid topologies are infinitely far.
+   */
+  unsigned distance(const ThreadTopology& other) const noexcept {
+    if( !valid() or !other.valid() ) return std::numeric_limits<unsigned>::max();
+    const size_t num_levels = std::max(level_ids_.size(), other.level_ids_.size());
+    for(size_t level = num_levels ; level > 0 ; --level){
+      const unsigned mine = level <= level_ids_.size() ? level_ids_[level-1] : 0;
+      const unsigned theirs = level <= other.level_ids_.size() ? other.level_ids_[level-1] : 0;
+      if( mine != theirs ) return level;
+    }
+    return 0;
+  }
 
   /**
       @return description of stream output operator
@@ -56,7 +121,9 @@ struct ThreadTopology{
    */
   friend std::ostream& operator<<(std::ostream& os, const ThreadTopology& in){
     if( in.valid() ) {
-      os << in.u2xapic() << ":";
+      if( in.u2xapic() != std::numeric_limits<unsigned>::max() ) os << in.u2xapic();
+      else os << "-";
+      os << ":";
       for(const auto& entry: in.level_ids()) { os << " " << entry; }
     }
     else {
@@ -66,58 +133,170 @@ struct ThreadTopology{
   }
 
   /**
-      Acquires 2xAPIC id and derive HT/core/package ID of the hardware thread carrying the execution.
-      The function supports only Intel processor with 2xAPIC at this time, and will throw otherwise.
+      Acquires 2xAPIC id and derive HT/core/.../package ID, plus the sharing of each cache,
+      of the hardware thread carrying the execution.
+      Intel processors are described by CPUID leaf 0x1F (which adds module/die levels) or 0xB, and leaf 4.
+      AMD processors are described by leaf 0xB, or 0x8000001E on older parts, and leaf 0x8000001D,
+      whose L3 sharing identifies the CCX.
+      The function throws for other vendors or if CPUID lacks topology enumeration.
       This method has strong exception guarentee.
    */
   void Acquire() {
     unsigned eax,ebx,ecx,edx;
 
     RunCpuid(0,0,eax,ebx,ecx,edx);
-    if( eax < 11 )
+    const unsigned max_leaf = eax;
+    const bool intel = !strncmp(reinterpret_cast<char*>(&ebx),"Genu",4)
+                   and !strncmp(reinterpret_cast<char*>(&edx),"ineI",4)
+                   and !strncmp(reinterpret_cast<char*>(&ecx),"ntel",4);
+    const bool amd = !strncmp(reinterpret_cast<char*>(&ebx),"Auth",4)
+                 and !strncmp(reinterpret_cast<char*>(&edx),"enti",4)
+                 and !strncmp(reinterpret_cast<char*>(&ecx),"cAMD",4);
+    if( !intel and !amd )
+      throw std::runtime_error("only Intel and AMD cpus are supported");
+    RunCpuid(0x80000000,0,eax,ebx,ecx,edx);
+    const unsigned max_ext_leaf = eax;
+
+    std::vector<unsigned> loc_level_ids;
+    std::vector<LevelType> loc_level_types;
+    unsigned loc_u2xapic;
+    // leaf 0x1F is valid if its 1st sub-leaf reports any logical processor
+    bool enumerated = false;
+    if( max_leaf >= 0x1F ){
+      RunCpuid(0x1F,0,eax,ebx,ecx,edx);
+      enumerated = (ebx & 0xFFFF) != 0 and ReadLevels(0x1F, loc_level_ids, loc_level_types, loc_u2xapic);
+    }
+    if( !enumerated and max_leaf >= 0xB ){
+      enumerated = ReadLevels(0xB, loc_level_ids, loc_level_types, loc_u2xapic);
+    }
+    if( !enumerated and amd and max_ext_leaf >= 0x8000001E ){
+      // extended apic id, core id, threads per core, node id
+      RunCpuid(0x8000001E,0,eax,ebx,ecx,edx);
+      const unsigned num_smt = ((ebx >> 8) & 0xFF) + 1;
+      loc_level_ids = { eax & ((1u << ShiftFor(num_smt)) - 1), ebx & 0xFF, ecx & 0xFF };
+      loc_level_types = { LevelType::Smt, LevelType::Core, LevelType::Die };
+      loc_u2xapic = eax;
+      enumerated = true;
+    }
+    if( !enumerated )
       throw std::runtime_error("CPUID does not support 2xAPIC");
-    if( strncmp(reinterpret_cast<char*>(&ebx),"Genu",4))
-      throw std::runtime_error("non-Intel cpu not supported");
-    if( strncmp(reinterpret_cast<char*>(&ecx),"ntel",4))
-      throw std::runtime_error("non-Intel cpu not supported");
-    if( strncmp(reinterpret_cast<char*>(&edx),"ineI",4))
-      throw std::runtime_error("non-Intel cpu not supported");
 
+    // deterministic cache parameters; a cache is shared by the threads whose 2xAPIC ids agree above
+    // the bits needed to address its sharers
+    const unsigned cache_leaf = intel ? 4 : 0x8000001D;
+    std::vector<Cache> loc_caches;
+    if( intel ? max_leaf >= 4 : max_ext_leaf >= 0x8000001D ){
+      for(unsigned index = 0 ; ; ++index){
+        RunCpuid(cache_leaf,index,eax,ebx,ecx,edx);
+        const unsigned type = eax & 0x1F;
+        if(type==0)
+          break;
+        const unsigned num_sharing = ((eax >> 14) & 0xFFF) + 1;
+        loc_caches.push_back(Cache{ (eax >> 5) & 0x7, static_cast<CacheType>(type), loc_u2xapic >> ShiftFor(num_sharing) });
+      }
+    }
+
+    // hybrid parts set CPUID.07H:EDX[15] and report the native model of each core in leaf 0x1A
+    CoreType loc_core_type = CoreType::Unknown;
+    if( intel and max_leaf >= 0x1A ){
+      RunCpuid(7,0,eax,ebx,ecx,edx);
+      if( edx & (1u << 15) ){
+        RunCpuid(0x1A,0,eax,ebx,ecx,edx);
+        const unsigned type = eax >> 24;
+        if( type == static_cast<unsigned>(CoreType::Efficiency) or type == static_cast<unsigned>(CoreType::Performance) ){
+          loc_core_type = static_cast<CoreType>(type);
+        }
+      }
+    }
+
+    level_ids_.swap(loc_level_ids);
+    level_types_.swap(loc_level_types);
+    caches_.swap(loc_caches);
+    u2xapic_ = loc_u2xapic;
+    core_type_ = loc_core_type;
+    valid_ = true;
+  }
+
+  ThreadTopology():
+    level_ids_(),
+    level_types_(),
+    caches_(),
+    u2xapic_(0xFFFFFFFF),
+    core_type_(CoreType::Unknown),
+    valid_(false) { }
+
+  /**
+      a snapshot built from known data, e.g. read from sysfs or a fake tree under test
+      @param level_types type of each entry of level_ids, defaults to SMT, core, ..., package if empty
+   */
+  ThreadTopology(unsigned u2xapic, std::vector<unsigned> level_ids, std::vector<Cache> caches,
+                 std::vector<LevelType> level_types = std::vector<LevelType>(),
+                 CoreType core_type = CoreType::Unknown):
+    level_ids_(std::move(level_ids)),
+    level_types_(std::move(level_types)),
+    caches_(std::move(caches)),
+    u2xapic_(u2xapic),
+    core_type_(core_type),
+    valid_(true) {
+    if( level_types_.empty() ){
+      for(size_t level = 0 ; level < level_ids_.size() ; ++level){
+        level_types_.push_back( level + 1 == level_ids_.size() ? LevelType::Package
+                              : level == 0 ? LevelType::Smt : LevelType::Core );
+      }
+    }
+  }
+
+private:
+  std::vector<unsigned> level_ids_;
+  std::vector<LevelType> level_types_;
+  std::vector<Cache> caches_;
+  unsigned u2xapic_;
+  CoreType core_type_;
+  bool valid_;
+
+  /**
+      reads the levels of leaf 0xB or 0x1F, the last id being the package above all enumerated levels
+      @return false if the leaf enumerates no level
+   */
+  bool ReadLevels(const unsigned leaf, std::vector<unsigned>& level_ids, std::vector<LevelType>& level_types, unsigned& u2xapic){
+    unsigned eax,ebx,ecx,edx=0;
     // done this way to be more future proof
     std::vector<unsigned> shift_to_next_level(1,0);
+    std::vector<LevelType> loc_level_types;
     for(unsigned level = 0 ; ; ++level){
-      RunCpuid(11,level,eax,ebx,ecx,edx);
+      RunCpuid(leaf,level,eax,ebx,ecx,edx);
 
-      const unsigned level_type = ecx>>8 & 0xF;
+      const unsigned level_type = ecx>>8 & 0xFF;
       if(level_type==0)
         break;
       if(level != (ecx&0xFF))
         throw std::logic_error("EDX inconsistent with Intel's description");
       shift_to_next_level.push_back(eax&0x1F);
+      loc_level_types.push_back(static_cast<LevelType>(level_type));
     }
-    std::vector<unsigned> loc_level_ids; loc_level_ids.reserve(3);
+    if( loc_level_types.empty() ) return false;
+    std::vector<unsigned> loc_level_ids; loc_level_ids.reserve(shift_to_next_level.size());
     for(size_t ii = 0 ; ii + 1< shift_to_next_level.size() ; ++ii) {
       loc_level_ids.push_back(
           (edx & ~(0xFFFFFFFF<<shift_to_next_level[ii+1])) >> shift_to_next_level[ii] );
     }
-    if(shift_to_next_level.size()>0){
-      loc_level_ids.push_back( edx >> shift_to_next_level.back() );
-    }
+    loc_level_ids.push_back( edx >> shift_to_next_level.back() );
+    loc_level_types.push_back(LevelType::Package);
 
-    level_ids_.swap(loc_level_ids);
-    u2xapic_ = edx;
-    valid_ = true;
+    level_ids.swap(loc_level_ids);
+    level_types.swap(loc_level_types);
+    u2xapic = edx;
+    return true;
   }
 
-  ThreadTopology():
-    level_ids_(),
-    u2xapic_(0xFFFFFFFF),
-    valid_(false) { }
-
-private:
-  std::vector<unsigned> level_ids_;
-  unsigned u2xapic_;
-  bool valid_;
+  /**
+      @return number of low id bits needed to tell num apart
+   */
+  static unsigned ShiftFor(unsigned num){
+    unsigned shift = 0;
+    while( (1u << shift) < num ) ++shift;
+    return shift;
+  }
 
   void RunCpuid(const unsigned a_in, const unsigned c_in
                , unsigned& a, unsigned& b, unsigned& c, unsigned& d){
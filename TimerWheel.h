@@ -0,0 +1,296 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <vector>
+#include <limits>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+namespace bayolau {
+namespace affinity {
+
+/**
+  * Handle to a timer of a TimerWheel. It stays safe to use after the timer fired or was cancelled.
+  */
+class Timer{
+public:
+  Timer() noexcept : index_(kNone), generation_(0) { }
+
+  /**
+    * @return true if the handle refers to a timer, which may have fired since
+    */
+  explicit operator bool() const noexcept { return index_ != kNone; }
+
+private:
+  template<class T> friend class TimerWheel;
+  static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+  Timer(uint32_t index, uint32_t generation) noexcept : index_(index), generation_(generation) { }
+  uint32_t index_;
+  uint32_t generation_;
+};
+
+/**
+  * Hierarchical timing wheel of payloads T due at integral ticks, with O(1) Add and Cancel.
+  *
+  * Level L has kSlots slots of kSlots^L ticks each. A timer sits at the highest level at which its due tick
+  * differs from the current tick, and moves down a level whenever the current tick reaches the start of its
+  * slot, so that each timer is handled at most once per level however far away it is due. Empty stretches of
+  * ticks are skipped by scanning per-level occupancy masks.
+  *
+  * Timers are kept in a vector and linked by index, and freed entries are reused, so that hundreds of
+  * thousands of pending timers cost one allocation per doubling. Not thread-safe.
+  */
+template<class T>
+class TimerWheel{
+public:
+  static constexpr unsigned kSlotBits = 6;
+  static constexpr unsigned kSlots = 1u << kSlotBits;
+  static constexpr unsigned kLevels = (64 + kSlotBits - 1) / kSlotBits; // enough for any 64-bit tick
+  static constexpr uint64_t kNever = std::numeric_limits<uint64_t>::max();
+
+  /**
+    * @param now first tick to be processed
+    */
+  explicit TimerWheel(uint64_t now = 0) : entries_(), free_(kNil), size_(0), now_(now) {
+    for(unsigned ll = 0 ; ll < kLevels ; ++ll){
+      occupied_[ll] = 0;
+      for(unsigned ss = 0 ; ss < kSlots ; ++ss) heads_[ll][ss] = kNil;
+    }
+  }
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  /**
+    * add a timer, a due tick already passed expires on the next Advance
+    * @param period if non-zero, the timer fires again every period ticks until cancelled
+    * @return handle for Cancel
+    */
+  Timer Add(uint64_t due, T payload, uint64_t period = 0) {
+    uint32_t index = free_;
+    if( index != kNil ){
+      free_ = entries_[index].next;
+    }
+    else {
+      index = static_cast<uint32_t>(entries_.size());
+      entries_.emplace_back();
+    }
+    Entry& entry = entries_[index];
+    entry.due = due < now_ ? now_ : due;
+    entry.period = period;
+    entry.payload = std::move(payload);
+    Link(index);
+    ++size_;
+    return Timer(index, entry.generation);
+  }
+
+  /**
+    * remove a timer so that it does not fire again
+    * @return true if the timer was pending, false if it already fired for good or was cancelled
+    */
+  bool Cancel(const Timer& timer) {
+    if( timer.index_ >= entries_.size() ) return false;
+    Entry& entry = entries_[timer.index_];
+    if( entry.generation != timer.generation_ or entry.slot == kNil ) return false;
+    Unlink(timer.index_);
+    Release(timer.index_);
+    return true;
+  }
+
+  /**
+    * fire every timer due at or before tick, in order of due tick.
+    * fire(T&) is called with the timer's payload, which a one-shot timer may move from, and must not
+    * add or cancel timers of this wheel. A periodic timer is rescheduled to its first due tick after tick,
+    * skipping the firings it missed.
+    */
+  template<class F>
+  void Advance(uint64_t tick, F fire) {
+    while( now_ <= tick ){
+      const uint64_t event = next();
+      if( event > tick ){
+        now_ = tick + 1;
+        return;
+      }
+      now_ = event;
+      for(unsigned ll = kLevels - 1 ; ll > 0 ; --ll){
+        if( (now_ & LowMask(ll)) == 0 ) Cascade(ll, SlotOf(now_, ll));
+      }
+      Expire(SlotOf(now_, 0), tick, fire);
+      ++now_;
+    }
+  }
+
+  /**
+    * @return a tick at which Advance has something to do, no later than the earliest due tick, kNever if empty
+    */
+  uint64_t next() const noexcept {
+    if( size_ == 0 ) return kNever;
+    uint64_t out = kNever;
+    for(unsigned ll = 0 ; ll < kLevels ; ++ll){
+      const unsigned current = SlotOf(now_, ll);
+      const uint64_t ahead = occupied_[ll] & (~uint64_t(0) << current);
+      if( !ahead ) continue;
+      const unsigned slot = static_cast<unsigned>(__builtin_ctzll(ahead));
+      const uint64_t start = (now_ & ~LowMask(ll + 1)) | (uint64_t(slot) << (ll * kSlotBits));
+      const uint64_t event = start < now_ ? now_ : start;
+      if( event < out ) out = event;
+    }
+    return out;
+  }
+
+  /**
+    * @return first tick not processed yet
+    */
+  uint64_t now() const noexcept { return now_; }
+
+  size_t size() const noexcept { return size_; }
+
+  bool empty() const noexcept { return size_ == 0; }
+
+private:
+  static constexpr uint32_t kNil = std::numeric_limits<uint32_t>::max();
+
+  struct Entry {
+    uint32_t prev = kNil;
+    uint32_t next = kNil; // slot list link, or free list link
+    uint32_t slot = kNil; // level * kSlots + slot, kNil if not linked
+    uint32_t generation = 0; // bumped on release, so that stale handles do not match
+    uint64_t due = 0;
+    uint64_t period = 0;
+    T payload = T();
+  };
+
+  /**
+    * @return mask of the ticks within one slot of level
+    */
+  static uint64_t LowMask(unsigned level) noexcept {
+    const unsigned bits = level * kSlotBits;
+    return bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+  }
+
+  static unsigned SlotOf(uint64_t tick, unsigned level) noexcept {
+    const unsigned bits = level * kSlotBits;
+    return bits >= 64 ? 0 : static_cast<unsigned>((tick >> bits) & (kSlots - 1));
+  }
+
+  void Link(uint32_t index) {
+    Entry& entry = entries_[index];
+    const uint64_t diff = entry.due ^ now_;
+    const unsigned level = diff == 0 ? 0 : static_cast<unsigned>(63 - __builtin_clzll(diff)) / kSlotBits;
+    const unsigned slot = SlotOf(entry.due, level);
+    uint32_t& head = heads_[level][slot];
+    entry.slot = level * kSlots + slot;
+    entry.prev = kNil;
+    entry.next = head;
+    if( head != kNil ) entries_[head].prev = index;
+    head = index;
+    occupied_[level] |= uint64_t(1) << slot;
+  }
+
+  void Unlink(uint32_t index) {
+    Entry& entry = entries_[index];
+    const unsigned level = entry.slot / kSlots;
+    const unsigned slot = entry.slot % kSlots;
+    if( entry.prev != kNil ) entries_[entry.prev].next = entry.next;
+    else heads_[level][slot] = entry.next;
+    if( entry.next != kNil ) entries_[entry.next].prev = entry.prev;
+    if( heads_[level][slot] == kNil ) occupied_[level] &= ~(uint64_t(1) << slot);
+    entry.slot = kNil;
+  }
+
+  void Release(uint32_t index) {
+    Entry& entry = entries_[index];
+    entry.payload = T();
+    ++entry.generation;
+    entry.next = free_;
+    free_ = index;
+    --size_;
+  }
+
+  /**
+    * @return the list of a slot, which is left empty
+    */
+  uint32_t Detach(unsigned level, unsigned slot) {
+    const uint32_t out = heads_[level][slot];
+    heads_[level][slot] = kNil;
+    occupied_[level] &= ~(uint64_t(1) << slot);
+    return out;
+  }
+
+  /**
+    * move the timers of a slot down, now that the current tick reached its start
+    */
+  void Cascade(unsigned level, unsigned slot) {
+    for(uint32_t index = Detach(level, slot) ; index != kNil ; ){
+      const uint32_t next = entries_[index].next;
+      Link(index);
+      index = next;
+    }
+  }
+
+  template<class F>
+  void Expire(unsigned slot, uint64_t tick, F& fire) {
+    for(uint32_t index = Detach(0, slot) ; index != kNil ; ){
+      const uint32_t next = entries_[index].next;
+      entries_[index].slot = kNil;
+      fire(entries_[index].payload);
+      Entry& entry = entries_[index];
+      if( entry.period > 0 ){
+        entry.due += entry.period * ((tick - entry.due) / entry.period + 1);
+        Link(index);
+      }
+      else {
+        Release(index);
+      }
+      index = next;
+    }
+  }
+
+  std::vector<Entry> entries_;
+  uint32_t free_; // head of the free entries
+  size_t size_;
+  uint64_t now_;
+  uint32_t heads_[kLevels][kSlots];
+  uint64_t occupied_[kLevels]; // bit per non-empty slot
+};
+
+template<class T>
+constexpr unsigned TimerWheel<T>::kSlotBits;
+template<class T>
+constexpr unsigned TimerWheel<T>::kSlots;
+template<class T>
+constexpr unsigned TimerWheel<T>::kLevels;
+template<class T>
+constexpr uint64_t TimerWheel<T>::kNever;
+template<class T>
+constexpr uint32_t TimerWheel<T>::kNil;
+
+}
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef WORK_STEALING_DEQUE_H
+#define WORK_STEALING_DEQUE_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "Pool.h"
+
+namespace bayolau {
+namespace threadsafe {
+/**
+  * Chase-Lev work-stealing deque, following the C11 formulation of Le et al. (PPoPP'13).
+  * Only the owner thread may push() and pop(), which work LIFO at the bottom.
+  * Any thread may steal(), which works FIFO at the top.
+  *
+  * The deque owns the elements it holds. Retired buffers are kept until destruction so that
+  * concurrent thieves never read from freed memory.
+  */
+template<typename T>
+struct WorkStealingDeque{
+  using DataPtr = memory::PoolPtr<T>;
+
+  /**
+    * owner only: push value to the bottom of the deque
+    */
+  void push(DataPtr&& val) {
+    const int64_t b = bottom_.load(std::memory_order_relaxed);
+    const int64_t t = top_.load(std::memory_order_acquire);
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    if( b - t > buffer->capacity() - 1 ){
+      buffer = Grow(buffer, t, b);
+    }
+    buffer->put(b, val.release());
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+  void push(T&& val) {
+    push(memory::MakePooled<T>(std::forward<T>(val)));
+  }
+
+  /**
+    * owner only: pop the bottom of the deque
+    * @return a smart pointer to the popped element if deque is nonempty, NULL otherwise
+    */
+  DataPtr pop() {
+    const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if( t > b ){
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return DataPtr();
+    }
+    T* out = buffer->get(b);
+    if( t == b ){ // last element, race against thieves
+      if( !top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) ){
+        out = nullptr;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return DataPtr(out);
+  }
+
+  /**
+    * any thread: steal the top of the deque
+    * @return a smart pointer to the stolen element, NULL if the deque is empty or the race is lost
+    */
+  DataPtr steal() {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = bottom_.load(std::memory_order_acquire);
+    if( t >= b ) return DataPtr();
+    T* out = buffer_.load(std::memory_order_acquire)->get(t);
+    if( !top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) ){
+      return DataPtr();
+    }
+    return DataPtr(out);
+  }
+
+  /**
+    * @return true if deque is empty, a snapshot when called by non-owner
+    */
+  bool empty() const {
+    const int64_t b = bottom_.load(std::memory_order_relaxed);
+    const int64_t t = top_.load(std::memory_order_relaxed);
+    return b <= t;
+  }
+
+  /**
+    * @param capacity initial capacity, must be a power of 2
+    */
+  explicit WorkStealingDeque(int64_t capacity = 256)
+    : top_(0), pad_(), bottom_(0), buffer_(nullptr), buffers_() {
+    buffers_.emplace_back(new Buffer(capacity));
+    buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+  }
+
+  ~WorkStealingDeque() {
+    while( pop() ) { }
+  }
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+private:
+  struct Buffer {
+    explicit Buffer(int64_t capacity): mask_(capacity - 1), slots_(new std::atomic<T*>[capacity]) { }
+    int64_t capacity() const noexcept { return mask_ + 1; }
+    T* get(int64_t ii) const noexcept { return slots_[ii & mask_].load(std::memory_order_relaxed); }
+    void put(int64_t ii, T* val) noexcept { slots_[ii & mask_].store(val, std::memory_order_relaxed); }
+  private:
+    const int64_t mask_;
+    std::unique_ptr<std::atomic<T*>[]> slots_;
+  };
+
+  std::atomic<int64_t> top_;
+  char pad_[64 - sizeof(std::atomic<int64_t>)]; // keep thieves and owner on separate cache lines
+  std::atomic<int64_t> bottom_;
+  std::atomic<Buffer*> buffer_;
+  std::vector<std::unique_ptr<Buffer>> buffers_; // owner only
+
+  Buffer* Grow(Buffer* old, int64_t t, int64_t b) {
+    buffers_.emplace_back(new Buffer(old->capacity() * 2));
+    Buffer* out = buffers_.back().get();
+    for(int64_t ii = t ; ii < b ; ++ii){
+      out->put(ii, old->get(ii));
+    }
+    buffer_.store(out, std::memory_order_release);
+    return out;
+  }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,107 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <iostream>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "ThreadPool.h"
+
+// compile with g++ -std=c++11 -O2 -lpthread alloc_count.cc -o alloc_count
+// exits with a non-zero status if a steady-state schedule/run cycle reaches the global heap
+
+namespace {
+std::atomic<bool> counting(false);
+std::atomic<size_t> num_allocations(0);
+}
+
+void* operator new(size_t size) {
+  if( counting.load(std::memory_order_relaxed) ) num_allocations.fetch_add(1, std::memory_order_relaxed);
+  if( void* out = std::malloc(size ? size : 1) ) return out;
+  throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try { return operator new(size); } catch(...) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  try { return operator new(size); } catch(...) { return nullptr; }
+}
+// not inlined, or gcc warns that free() receives memory from new
+__attribute__((noinline)) void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { operator delete(ptr); }
+
+/**
+  * run cycle warm_up times, then count the heap allocations of num_cycles more
+  * @return true if error occurs, i.e. some allocation was counted
+  */
+template<class Cycle>
+bool Check(const char* name, Cycle cycle, size_t warm_up = 10000, size_t num_cycles = 10000) {
+  for(size_t ii = 0 ; ii < warm_up ; ++ii) cycle();
+  num_allocations = 0;
+  counting = true;
+  for(size_t ii = 0 ; ii < num_cycles ; ++ii) cycle();
+  counting = false;
+  const size_t count = num_allocations.load();
+  std::cout << name << ": " << count << " allocations in " << num_cycles << " cycles" << std::endl;
+  return count != 0;
+}
+
+int main (int argc, const char* argv[]){
+  using bayolau::affinity::ThreadPool;
+  using bayolau::affinity::TaskGroup;
+  ThreadPool pool(false);
+  std::atomic<size_t> sum(0);
+  bool failed = false;
+
+  failed = Check("Schedule(work) and Wait(future)", [&]{
+    ThreadPool::Future future = pool.Schedule([&sum]{ ++sum; });
+    pool.Wait(future);
+  }) or failed;
+
+  failed = Check("Submit(work) and Wait()", [&]{
+    pool.Submit([&sum]{ ++sum; });
+    pool.Wait();
+  }) or failed;
+
+  TaskGroup group;
+  failed = Check("Schedule(group, work) and Wait(group)", [&]{
+    pool.Schedule(group, [&sum]{ ++sum; });
+    pool.Wait(group);
+  }) or failed;
+
+  failed = Check("Submit from a worker", [&]{
+    // always worker 0, so that the warm-up fills the free lists of the thread which allocates
+    pool.Schedule(group, bayolau::affinity::Target::Worker(0), [&pool,&sum]{
+      for(int ii = 0 ; ii < 8 ; ++ii) pool.Submit([&sum]{ ++sum; });
+    });
+    pool.Wait(group);
+    pool.Wait();
+  }) or failed;
+
+  std::cout << (failed ? "FAILED" : "passed") << std::endl;
+  return failed ? 1 : 0;
+}
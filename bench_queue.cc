@@ -0,0 +1,87 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "Queue.h"
+#include "RingQueue.h"
+
+// compile with g++ -std=c++11 -O2 -lpthread bench_queue.cc -o bench_queue
+
+/**
+  * push num_items ints from num_producers threads, drain them with num_consumers threads
+  * @return millions of items per second
+  */
+template<class Q>
+double Run(Q& queue, unsigned num_producers, unsigned num_consumers, size_t num_items, size_t batch){
+  std::atomic<size_t> num_popped(0);
+  std::vector<std::thread> threads;
+  const size_t per_producer = num_items / num_producers / batch * batch;
+  const size_t total = per_producer * num_producers;
+  const auto start = std::chrono::steady_clock::now();
+  for(unsigned cc = 0 ; cc < num_consumers ; ++cc){
+    threads.emplace_back([&]{
+      while( num_popped.load(std::memory_order_relaxed) < total ){
+        if( queue.pop() ) ++num_popped;
+        else std::this_thread::yield();
+      }
+    });
+  }
+  for(unsigned pp = 0 ; pp < num_producers ; ++pp){
+    threads.emplace_back([&]{
+      std::vector<int> values(batch);
+      for(size_t ii = 0 ; ii < per_producer ; ii += batch){
+        while( batch == 1 ? queue.push(int(ii))
+                          : queue.push(std::make_move_iterator(values.begin()),
+                                       std::make_move_iterator(values.end())) ){
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for(auto& entry : threads){
+    entry.join();
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return total / elapsed.count() * 1e-6;
+}
+
+int main (int argc, const char* argv[]){
+  using namespace bayolau::threadsafe;
+  const size_t num_items = 1<<20;
+  const unsigned num_consumers = std::max(1u, std::thread::hardware_concurrency() / 2);
+  std::cout << "producers batch    Queue(Mops/s) RingQueue(Mops/s), " << num_consumers << " consumers" << std::endl;
+  for(unsigned num_producers : {1u, 8u, 64u}){
+    for(size_t batch : {1u, 16u}){
+      Queue<int> queue;
+      RingQueue<int> ring(1<<12);
+      const double q = Run(queue, num_producers, num_consumers, num_items, batch);
+      const double r = Run(ring, num_producers, num_consumers, num_items, batch);
+      std::cout << num_producers << "\t  " << batch << "\t   " << q << "\t\t" << r << std::endl;
+    }
+  }
+}
@@ -0,0 +1,74 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+// compile with g++ -std=c++11 -O2 -lpthread check_capacity.cc -o check_capacity
+// exits with a non-zero status if work is rejected by a pool which is below capacity, e.g. because a package
+// was taken before it was counted as queued
+
+int main (int argc, const char* argv[]){
+  using namespace bayolau::affinity;
+  const unsigned num_producers = 4;
+  const size_t num_submits = argc > 1 ? std::stoul(argv[1]) : 20000;
+  ThreadPool pool(Placement::Unpinned().Threads(4));
+  // far more than could ever be queued: each submission queues at most two packages
+  pool.SetCapacity(4 * num_producers * num_submits, Overflow::Fail);
+  std::atomic<size_t> num_rejected(0);
+  std::atomic<size_t> num_queued(0);
+  std::atomic<size_t> num_ran(0);
+  std::vector<std::thread> producers;
+  for(unsigned pp = 0 ; pp < num_producers ; ++pp){
+    producers.emplace_back([&]{
+      for(size_t ss = 0 ; ss < num_submits ; ++ss){
+        // the child is pushed to the deque of a worker, where idle workers steal it at once
+        // counted as queued beforehand, so that num_ran never catches up with num_queued early
+        ++num_queued;
+        const bool queued = pool.TrySubmit([&]{
+          ++num_queued;
+          if( !pool.TrySubmit([&]{ ++num_ran; }) ){
+            --num_queued;
+            ++num_rejected;
+          }
+          ++num_ran;
+        });
+        if( !queued ){
+          --num_queued;
+          ++num_rejected;
+        }
+      }
+    });
+  }
+  for(auto& producer : producers) producer.join();
+  while( num_ran.load() < num_queued.load() ) pool.Wait(); // Wait does not cover running parents
+  if( num_rejected.load() > 0 ){
+    std::cout << "FAILED: " << num_rejected.load() << " submissions rejected below capacity" << std::endl;
+    return 1;
+  }
+  std::cout << "passed, " << num_ran.load() << " packages run" << std::endl;
+  return 0;
+}
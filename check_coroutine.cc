@@ -0,0 +1,176 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <iostream>
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include "Coroutine.h"
+
+// compile with g++ -std=c++20 -O2 -lpthread check_coroutine.cc -o check_coroutine
+// exits with a non-zero status if the coroutine executor of Coroutine.h misbehaves
+
+namespace {
+using namespace bayolau::affinity;
+
+unsigned num_failures = 0;
+
+template<class T>
+void Expect(const char* what, const T& actual, const T& expected) {
+  if( actual == expected ) return;
+  ++num_failures;
+  std::cout << "FAILED " << what << std::endl;
+}
+
+std::string Message(std::exception_ptr error) {
+  try {
+    std::rethrow_exception(error);
+  }
+  catch(std::exception& e) {
+    return e.what();
+  }
+  catch(...) {
+    return "unknown";
+  }
+}
+
+coro::Task<int> Square(ThreadPool& pool, int x) {
+  co_await coro::Resume(pool);
+  co_return x * x;
+}
+
+coro::Task<void> Throw(ThreadPool& pool) {
+  co_await coro::Resume(pool);
+  throw std::runtime_error("thrown by a coroutine");
+}
+
+coro::Task<int> SumOfSquares(ThreadPool& pool, int n) {
+  std::vector<coro::Task<int>> squares;
+  for(int ii = 0 ; ii < n ; ++ii) squares.push_back(Square(pool, ii));
+  const std::vector<int> values = co_await coro::WhenAll(std::move(squares));
+  int out = 0;
+  for(const int value : values) out += value;
+  co_return out;
+}
+
+coro::Task<bool> OffCaller(ThreadPool& pool, std::thread::id caller) {
+  co_await coro::Resume(pool, Priority::High);
+  co_return std::this_thread::get_id() != caller;
+}
+
+// the threads each worker resumes the coroutine on, which must be one per worker
+coro::Task<size_t> NumThreadsOfWorkers(ThreadPool& pool, unsigned num_workers) {
+  std::set<std::thread::id> threads;
+  for(unsigned rr = 0 ; rr < 4 ; ++rr){
+    for(unsigned ww = 0 ; ww < num_workers ; ++ww){
+      co_await coro::ResumeOn(pool, Target::Worker(ww));
+      threads.insert(std::this_thread::get_id());
+    }
+  }
+  co_return threads.size();
+}
+
+coro::Task<void> WhenAllThrows(ThreadPool& pool, std::atomic<int>& count) {
+  std::vector<coro::Task<void>> tasks;
+  tasks.push_back(Throw(pool));
+  for(int ii = 0 ; ii < 8 ; ++ii){
+    tasks.push_back([](ThreadPool& pool, std::atomic<int>& count) -> coro::Task<void> {
+      co_await coro::Resume(pool);
+      ++count;
+    }(pool, count));
+  }
+  co_await coro::WhenAll(std::move(tasks));
+}
+
+coro::Task<void> Increment(ThreadPool& pool, std::atomic<int>& count) {
+  co_await coro::Resume(pool);
+  ++count;
+}
+}
+
+int main (int argc, const char* argv[]){
+  const unsigned num_workers = 4;
+  ThreadPool pool(Placement::Unpinned().Threads(num_workers));
+
+  Expect("SyncWait of a task", coro::SyncWait(Square(pool, 7)), 49);
+  Expect("Resume leaves the caller", coro::SyncWait(OffCaller(pool, std::this_thread::get_id())), true);
+  Expect("WhenAll results", coro::SyncWait(SumOfSquares(pool, 100)), 328350);
+  Expect("WhenAll of nothing", coro::SyncWait(coro::WhenAll(std::vector<coro::Task<int>>())).empty(), true);
+  Expect("ResumeOn each worker", coro::SyncWait(NumThreadsOfWorkers(pool, num_workers)), size_t(num_workers));
+
+  std::string error;
+  try {
+    coro::SyncWait(Throw(pool));
+  }
+  catch(std::exception& e) {
+    error = e.what();
+  }
+  Expect("SyncWait rethrows", error, std::string("thrown by a coroutine"));
+
+  std::atomic<int> count(0);
+  error.clear();
+  try {
+    coro::SyncWait(WhenAllThrows(pool, count));
+  }
+  catch(std::exception& e) {
+    error = e.what();
+  }
+  Expect("WhenAll rethrows", error, std::string("thrown by a coroutine"));
+  Expect("WhenAll finishes the others", count.load(), 8);
+
+  // spawned tasks report to the exception handler
+  std::atomic<int> num_errors(0);
+  pool.SetExceptionHandler([&num_errors](std::exception_ptr){ ++num_errors; });
+  count = 0;
+  for(int ii = 0 ; ii < 1000 ; ++ii) coro::Spawn(pool, Increment(pool, count));
+  coro::Spawn(pool, Throw(pool));
+  while( count.load() < 1000 or num_errors.load() < 1 ) pool.Wait();
+  Expect("Spawn runs every task", count.load(), 1000);
+  Expect("Spawn reports the exception", num_errors.load(), 1);
+
+  // at capacity under Overflow::Fail, the task's own exception reaches the handler, not the refusal
+  {
+    ThreadPool full(Placement::Unpinned().Threads(1));
+    std::atomic<bool> started(false);
+    std::atomic<bool> release(false);
+    full.Submit([&started,&release]{
+      started = true;
+      while( !release.load() ) std::this_thread::yield();
+    });
+    while( !started.load() ) std::this_thread::yield();
+    full.SetCapacity(1, Overflow::Fail);
+    full.Submit([]{});
+    std::vector<std::string> reported;
+    full.SetExceptionHandler([&reported](std::exception_ptr error){ reported.push_back(Message(error)); });
+    coro::Spawn(full, Throw(full)); // both resumptions are refused, so the task runs inline
+    Expect("exception of a task spawned at capacity", reported, std::vector<std::string>({"thrown by a coroutine"}));
+    release = true;
+    full.Wait();
+  }
+
+  std::cout << (num_failures > 0 ? "FAILED" : "passed") << std::endl;
+  return num_failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <cstdlib>
+#include <functional>
+#include "ThreadPool.h"
+
+// compile with g++ -std=c++11 -O2 -lpthread check_repin.cc -o check_repin
+// exits with a non-zero status if Repin hangs while running work posts to the workers it quiesces,
+// e.g. through a static ParallelFor or the construction of a WorkerLocal
+
+int main (int argc, const char* argv[]){
+  using namespace bayolau::affinity;
+  std::atomic<bool> stop(false);
+  std::atomic<size_t> rounds(0);
+  ThreadPool pool(Placement::Unpinned().Threads(4));
+  TaskGroup group;
+  // each round posts chunks to every active worker and waits for them, then schedules the next round
+  std::function<void()> round = [&]{
+    pool.ParallelFor(0, 16, 1, [](int){ std::this_thread::sleep_for(std::chrono::microseconds(50)); }, Partition::Static);
+    ThreadPool::WorkerLocal<int> locals(pool, 1);
+    ++rounds;
+    if( !stop.load() ) pool.Schedule(group, round);
+  };
+  for(unsigned tt = 0 ; tt < 2 ; ++tt) pool.Schedule(group, round);
+  // Repin from another thread, so that a hang can be reported instead of waited for
+  std::packaged_task<void()> repins([&pool]{
+    for(unsigned rr = 0 ; rr < 100 ; ++rr){
+      pool.Repin(Placement::Unpinned().Threads(rr % 2 == 0 ? 2 : 4));
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  std::future<void> done = repins.get_future();
+  std::thread repinner(std::move(repins));
+  if( done.wait_for(std::chrono::seconds(30)) != std::future_status::ready ){
+    std::cout << "FAILED: Repin did not return" << std::endl;
+    std::_Exit(1);
+  }
+  repinner.join();
+  stop = true;
+  pool.Wait(group);
+  std::cout << "passed, " << rounds.load() << " rounds" << std::endl;
+  return 0;
+}
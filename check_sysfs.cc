@@ -0,0 +1,90 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Bayo Lau bayo.lau@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <iostream>
+#include <vector>
+#include <limits>
+#include "CpuTopology.h"
+
+// compile with g++ -std=c++11 -O2 -lpthread check_sysfs.cc -o check_sysfs
+// run from the repository root, or pass the fake sysfs and cgroup roots as arguments.
+// testdata/sysfs describes 2 packages, each its own NUMA node, of 2 cores with 2 hyperthreads each;
+// siblings are numbered n and n+4, so that node and cache lists mix ranges and commas.
+// Each case of testdata/cgroup holds a cgroup hierarchy in fs and the process's membership in proc_cgroup
+
+namespace {
+unsigned num_failures = 0;
+
+template<class T>
+void Expect(const char* what, const T& actual, const T& expected) {
+  if( actual == expected ) return;
+  ++num_failures;
+  std::cout << "FAILED " << what << std::endl;
+}
+}
+
+int main (int argc, const char* argv[]){
+  using namespace bayolau::affinity;
+  const std::string root = argc > 1 ? argv[1] : "testdata/sysfs";
+  const std::string cgroups = argc > 2 ? argv[2] : "testdata/cgroup";
+  const unsigned none = std::numeric_limits<unsigned>::max();
+
+  const NumaTopology numa = NumaTopology::Read(root);
+  Expect("nodes", numa.nodes(), std::vector<unsigned>({0, 1}));
+  Expect("cpus of node 0", numa.cpus(0), std::vector<unsigned>({0, 1, 4, 5}));
+  Expect("cpus of node 1", numa.cpus(1), std::vector<unsigned>({2, 3, 6, 7}));
+  Expect("cpus of an unknown node", numa.cpus(2), std::vector<unsigned>());
+  Expect("node of cpu 5", numa.node_of(5), 0u);
+  Expect("node of cpu 6", numa.node_of(6), 1u);
+  Expect("node of an unknown cpu", numa.node_of(8), none);
+  Expect("local distance", numa.distance(1, 1), 10u);
+  Expect("remote distance", numa.distance(0, 1), 21u);
+  Expect("distance to an unknown node", numa.distance(0, 2), none);
+  Expect("missing tree", NumaTopology::Read(root + "/missing").empty(), true);
+
+  const CpuTopology topology = CpuTopology::ReadSysfs(root);
+  Expect("number of cpus", topology.num_cpus(), size_t(8));
+  Expect("number of cores", topology.num_cores(), size_t(4));
+  Expect("caches of cpu 0, instruction included", topology.topology(0).caches().size(), size_t(4));
+  Expect("L1 siblings of cpu 0", topology.cpus_sharing_cache(0, 1), std::vector<unsigned>({0, 4}));
+  Expect("L2 siblings of cpu 5", topology.cpus_sharing_cache(5, 2), std::vector<unsigned>({1, 5}));
+  Expect("L3 siblings of cpu 0", topology.cpus_sharing_cache(0, 3), std::vector<unsigned>({0, 1, 4, 5}));
+  Expect("L3 siblings of cpu 6", topology.cpus_sharing_cache(6, 3), std::vector<unsigned>({2, 3, 6, 7}));
+  Expect("unknown cache level", topology.cpus_sharing_cache(0, 4), std::vector<unsigned>({0}));
+  Expect("distance between SMT siblings", topology.distance(0, 4), 1u);
+  Expect("distance between cores sharing L3", topology.distance(0, 5), 2u);
+  Expect("distance across nodes", topology.distance(1, 2), 5u);
+  Expect("node of cpu 7", topology.node_of(7), 1u);
+  Expect("numa distance of cpus", topology.numa().distance(topology.node_of(0), topology.node_of(3)), 21u);
+
+  Expect("v2 quota of a parent cgroup", CpuTopology::CpuQuota(cgroups + "/v2/fs", cgroups + "/v2/proc_cgroup"), 3u);
+  Expect("v2 quota at the root", CpuTopology::CpuQuota(cgroups + "/v2-namespace/fs", cgroups + "/v2-namespace/proc_cgroup"), 2u);
+  Expect("v2 without membership", CpuTopology::CpuQuota(cgroups + "/v2/fs", cgroups + "/missing"), 0u);
+  Expect("v1 quota of the cpu cgroup", CpuTopology::CpuQuota(cgroups + "/v1/fs", cgroups + "/v1/proc_cgroup"), 2u);
+  Expect("v1 quota at the root", CpuTopology::CpuQuota(cgroups + "/v1-namespace/fs", cgroups + "/v1-namespace/proc_cgroup"), 1u);
+  Expect("missing hierarchy", CpuTopology::CpuQuota(cgroups + "/missing", cgroups + "/v2/proc_cgroup"), 0u);
+
+  std::cout << (num_failures > 0 ? "FAILED" : "passed") << std::endl;
+  return num_failures > 0 ? 1 : 0;
+}
@@ -27,12 +27,38 @@ SOFTWARE.
 
 #include <functional>
 #include <iterator>
+#include <utility>
+#include <type_traits>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
 
 namespace bayolau {
 namespace util {
 
 template<class Iterator> struct FilteredIterator;
 
+/**
+  * value is true if F can be called with no argument
+  */
+template<class F>
+struct IsNullaryCallable{
+private:
+  template<class G> static auto test(int) -> decltype(std::declval<G&>()(), std::true_type());
+  template<class G> static std::false_type test(...);
+public:
+  static constexpr bool value = decltype(test<F>(0))::value;
+};
+
+/**
+  * @return false if the callable converts to false, e.g. an empty std::function or a null pointer
+  */
+template<class F>
+bool NonEmpty(const F& f);
+
 /**
   * @return a pair of iterators over a [begin,end) range, skipping elements evaluated to false for the predicate
   */
@@ -86,6 +112,67 @@ std::pair<FilteredIterator<Iterator>,FilteredIterator<Iterator> >
                          FilteredIterator<Iterator>(end,end,pred));
 }
 
+/**
+  * reads the whole content of a (typically sysfs) text file
+  * @return true if error occurs
+  */
+inline bool ReadFile(const std::string& path, std::string& content){
+  std::ifstream ifs(path.c_str());
+  if( !ifs ) return true;
+  std::ostringstream oss;
+  oss << ifs.rdbuf();
+  content = oss.str();
+  return false;
+}
+
+/**
+  * parses a linux cpu list such as "0-3,8,10-11\n" into sorted ids
+  * @return true if error occurs
+  */
+inline bool ParseCpuList(const std::string& text, std::vector<unsigned>& ids){
+  std::vector<unsigned> loc;
+  const char* curr = text.c_str();
+  while( *curr != '\0' and *curr != '\n' ){
+    char* next;
+    const unsigned long first = std::strtoul(curr, &next, 10);
+    if( next == curr ) return true;
+    unsigned long last = first;
+    if( *next == '-' ){
+      curr = next + 1;
+      last = std::strtoul(curr, &next, 10);
+      if( next == curr or last < first ) return true;
+    }
+    for(unsigned long id = first ; id <= last ; ++id) loc.push_back(id);
+    curr = next;
+    if( *curr == ',' ) ++curr;
+    else if( *curr != '\0' and *curr != '\n' ) return true;
+  }
+  std::sort(loc.begin(), loc.end());
+  loc.erase(std::unique(loc.begin(), loc.end()), loc.end());
+  ids.swap(loc);
+  return false;
+}
+
+template<class F>
+auto NonEmptyImpl(const F& f, int) -> decltype(static_cast<bool>(f)) { return static_cast<bool>(f); }
+
+template<class F>
+bool NonEmptyImpl(const F&, long) { return true; }
+
+template<class F>
+bool NonEmpty(const F& f) { return NonEmptyImpl(f, 0); }
+
+/**
+  * hint to the cpu that the caller is busy-waiting, which frees resources for the SMT sibling
+  */
+inline void CpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
 }
 }
 